@@ -1,5 +1,7 @@
 #include "compressor.h"
 #include "utils.h"
+#include "kernels.h"
+#include <limits>
 
 namespace Compressor {
     using std::priority_queue;
@@ -9,9 +11,30 @@ namespace Compressor {
     /// @param outputFilePath 
     void HuffCompressor::compress(const std::filesystem::path& inputFilePath, const vector<uint8_t> file_input) {
         // Bring everything together
+        vector<uint8_t> outputFileBuffer;
+        try {
+            compressToBuffer(inputFilePath.filename().string(), file_input, outputFileBuffer);
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << std::endl;
+            exit(1);
+        }
+
+        // Write the compressed data to a file
+        Utils::writeFile(compressedPathFor(inputFilePath).string(), outputFileBuffer);
+
+        std::cout << "Done. " << std::endl;
+    }
 
-        // File has been read in main program - Create the frequency table
-        buildFrequencyTable(file_input);
+    /// @brief Compress in memory - used by compress and by the daemon, which keeps one compressor per worker
+    /// @param fileName original file name, stored in the output so decompress can restore it
+    /// @param input data to compress
+    /// @param output receives the whole .fcm file. Its capacity is reused
+    void HuffCompressor::compressToBuffer(const string& fileName, const vector<uint8_t>& input, vector<uint8_t>& output) {
+        // Start from a clean state so the same compressor can be used for many files
+        reset();
+
+        // File has been read by the caller - Create the frequency table
+        buildFrequencyTable(input);
 
         // Build the Huffman tree from the frequency table
         root = buildHuffmanTree(std::nullopt);
@@ -20,10 +43,15 @@ namespace Compressor {
         generateHuffmanCodes(root, {});
 
         // Encode the data using the Huffman codes
-        pair<vector<uint8_t>, int> encodedData = encodeData(file_input);
+        uint32_t totalBits = encodeData(input, encodedBytes);
 
-        // Write the compressed data to a file
-        writeCompressedData(inputFilePath, encodedData);
+        // Lay out the compressed file
+        writeCompressedData(fileName, totalBits, encodedBytes, output);
+    }
+
+    /// @brief <input directory>/<input stem>_compressed.fcm
+    std::filesystem::path HuffCompressor::compressedPathFor(const std::filesystem::path& inputFilePath) {
+        return inputFilePath.parent_path() / (inputFilePath.stem().string() + "_compressed.fcm");
     }
 
     void HuffCompressor::printHuffmanTree(HuffmanNode* node, const std::string& code) {
@@ -46,8 +74,21 @@ namespace Compressor {
     /// @brief  Creates a map of each character and how often they appear in the input
     /// @param input - file data converted to a byte vector. 
     void HuffCompressor::buildFrequencyTable(const vector<uint8_t>& input) {
-        for (const uint8_t &byte : input) {
-            frequencyTable[byte]++;
+        // Count into a flat array with the fastest kernel for this CPU, then keep only the bytes that appear
+        uint64_t counts[256] = {};
+        Kernels::active().histogram(input.data(), input.size(), counts);
+
+        // Frequencies are stored as int, and building the tree adds them all up in an int
+        uint64_t total = 0;
+        for (int byte = 0; byte < 256; byte++) {
+            total += counts[byte];
+            if (counts[byte] > static_cast<uint64_t>(std::numeric_limits<int>::max()) ||
+                total > static_cast<uint64_t>(std::numeric_limits<int>::max())) {
+                throw std::runtime_error("Error: Input is too large to compress.");
+            }
+            if (counts[byte] > 0) {
+                frequencyTable[static_cast<uint8_t>(byte)] += static_cast<int>(counts[byte]);
+            }
         }
     }
     
@@ -67,12 +108,16 @@ namespace Compressor {
          */
         priority_queue<HuffmanNode*, vector<HuffmanNode*>, HuffmanCompare> min_heap;
 
+        // Frees the previous tree. Reserving the most nodes a tree can have means the pointers below stay valid
+        nodePool.clear();
+        nodePool.reserve(2 * 256 - 1);
+
         // sort frequency table before inserting into min_heap - solved decompression problem - guarantees consistency when inserting since we'll always insert in the same order
         std::map<uint8_t, int> sortedFrequencyTable(receivedFrequencyTable.value_or(frequencyTable).begin(), 
                                                     receivedFrequencyTable.value_or(frequencyTable).end());
 
         for (const auto &entry : sortedFrequencyTable) {
-            min_heap.push(new HuffmanNode(entry.first, entry.second));
+            min_heap.push(&nodePool.emplace_back(entry.first, entry.second));
         }
  
         // Build the actual Huffman tree
@@ -86,7 +131,7 @@ namespace Compressor {
             // Create a combined node for the two frequencies and push back into the queue
             // You don't need valid data in internal (combined) nodes in a huffman tree so it's often intialized with 0 or nothing
             // Their purpose is to connect the leaf nodes and represent the combined frequency of their children
-            HuffmanNode *combined = new HuffmanNode(0, left->frequency + right->frequency);
+            HuffmanNode *combined = &nodePool.emplace_back(0, left->frequency + right->frequency);
             combined->left = left;
             combined->right = right;
 
@@ -119,53 +164,52 @@ namespace Compressor {
 
     /// @brief Encodes the original file data into huffman code - ready for writing 
     /// @param data original file data to map byte to huffman code
-    /// @return bitstring of huffman code
-    pair<vector<uint8_t>, int> HuffCompressor::encodeData(const vector<uint8_t> &data) {
-        string bitString;
-        for (auto byte: data) {
-            string code = huffmanCodes[byte];
-            for (auto bit : code) {
-                bitString += (bit == '1') ? '1' : '0';
+    /// @param byteArray receives the packed huffman code bytes
+    /// @return the number of bits used
+    uint32_t HuffCompressor::encodeData(const vector<uint8_t> &data, vector<uint8_t>& byteArray) {
+        // Turn the "0101" code strings into integers the packing kernel can shift in directly
+        uint64_t codes[256] = {};
+        uint8_t lengths[256] = {};
+        uint64_t totalBits = 0;
+
+        for (const auto &entry : huffmanCodes) {
+            const string& code = entry.second;
+            if (code.length() > Kernels::MAX_CODE_LENGTH) {
+                throw std::runtime_error("Error: Huffman code too long to encode.");
             }
-        }
-
-        // Iterate over bitString and pack it into bytes
-        std::vector<uint8_t> byteArray;
 
-        size_t length = bitString.length();
-        uint8_t currentByte = 0;
-        int bitCount = 0;
-
-        for (char bit : bitString) {
-            // Shift left to make room for the new bit
-            // If the current bit is '1', set the least significant bit
-            currentByte = (currentByte << 1) | (bit - '0');
-
-            bitCount++;
+            uint64_t value = 0;
+            for (char bit : code) {
+                value = (value << 1) | (bit == '1' ? 1 : 0);
+            }
+            codes[entry.first] = value;
+            lengths[entry.first] = static_cast<uint8_t>(code.length());
 
-            // If we have collected 8 bits, push it to the array
-            if (bitCount == 8) {
-                byteArray.push_back(currentByte);
-                currentByte = 0;
-                bitCount = 0;
+            auto frequency = frequencyTable.find(entry.first);
+            if (frequency != frequencyTable.end()) {
+                totalBits += static_cast<uint64_t>(frequency->second) * code.length();
             }
         }
 
-        // Handle the last byte if it doesn't have 8 bits
-        if (bitCount > 0) {
-            // Shift the remaining bits to the left to fill the byte
-            currentByte <<= (8 - bitCount);
-            byteArray.push_back(currentByte);
+        // The file format stores the bit count as a uint32_t
+        if (totalBits > std::numeric_limits<uint32_t>::max()) {
+            throw std::runtime_error("Error: Input is too large to compress - the encoded data would exceed 2^32 bits.");
         }
 
-        // Return the byte array and the total number of bits
-        return pair<vector<uint8_t>, int>(byteArray, length);
+        // Pack the codes MSB first into bytes, the last byte is padded with zeros
+        byteArray.resize((totalBits + 7) / 8);
+        Kernels::active().packBits(data.data(), data.size(), codes, lengths, byteArray.data());
+
+        return static_cast<uint32_t>(totalBits);
     }
 
-    /// @brief Function to write the compressed data to an output file
-    /// @param outputFilePath Path to the output file 
-    /// @param encodedData Huffman encoded data and the original size of the bitString
-    void HuffCompressor::writeCompressedData(const std::filesystem::path& inputFilePath, pair<vector<uint8_t>, int>& encodedData) {
+    /// @brief Function to lay out the compressed data in the output file format
+    /// @param fileName original file name
+    /// @param totalBits size of the encoded data in bits
+    /// @param encodedData Huffman encoded data
+    /// @param outputFileBuffer receives the file contents
+    void HuffCompressor::writeCompressedData(const string& fileName, uint32_t totalBits, const vector<uint8_t>& encodedData,
+                                             vector<uint8_t>& outputFileBuffer) {
         // Layout of output file looks like this:
         /**
          * 
@@ -185,53 +229,50 @@ namespace Compressor {
             | compressed data bytes   |  // 0xD7, 0x20, etc.
             +-------------------------+
          */
-        vector<uint8_t> outputFileBuffer;
+        outputFileBuffer.clear();
+        outputFileBuffer.reserve(4 + fileName.size() + 4 + frequencyTable.size() * 5 + 4 + encodedData.size());
 
         // Write original file name size
-        uint32_t nameSize = inputFilePath.filename().string().size();
+        uint32_t nameSize = static_cast<uint32_t>(fileName.size());
         Utils::appendToBuffer(outputFileBuffer, nameSize);
 
         // Write original file name (the original extension is included)
-        string filename = inputFilePath.filename().string();
-        outputFileBuffer.insert(outputFileBuffer.end(), filename.begin(), filename.end());
+        outputFileBuffer.insert(outputFileBuffer.end(), fileName.begin(), fileName.end());
 
         // Write tableSize
         uint32_t tableSize = static_cast<uint32_t>(frequencyTable.size());
         Utils::appendToBuffer(outputFileBuffer, tableSize);
 
-        // Write each frequency table entry
-        for (const auto &entry : frequencyTable) {
-            Utils::appendToBuffer(outputFileBuffer, entry.first);
-            Utils::appendToBuffer(outputFileBuffer, entry.second);
+        // Write each frequency table entry, in byte order - the hash map's own order depends on its history,
+        // so a compressor reused for many files (the daemon) would otherwise write different bytes for the same input
+        for (int byte = 0; byte < 256; byte++) {
+            auto entry = frequencyTable.find(static_cast<uint8_t>(byte));
+            if (entry == frequencyTable.end()) continue;
+            Utils::appendToBuffer(outputFileBuffer, entry->first);
+            Utils::appendToBuffer(outputFileBuffer, entry->second);
         }
 
         // Write totalBits
-        uint32_t totalBits = static_cast<uint32_t>(encodedData.second);
         Utils::appendToBuffer(outputFileBuffer, totalBits);
 
         // Write compressed data
-        outputFileBuffer.insert(outputFileBuffer.end(), encodedData.first.begin(), encodedData.first.end());
-
-        // Generate the output file name and Write the output file
-        // Create the output file path
-        string parent_path = inputFilePath.parent_path().string();
-        string outputFilePath = "";
-        if (parent_path == ".") {
-            outputFilePath = inputFilePath.stem().string() + "_compressed.fcm";
-        } else {
-            outputFilePath = parent_path + "\\" + inputFilePath.stem().string() + "_compressed.fcm";
-        }
-        Utils::writeFile(outputFilePath, outputFileBuffer);
+        outputFileBuffer.insert(outputFileBuffer.end(), encodedData.begin(), encodedData.end());
+    }
 
-        std::cout << "Done. " << std::endl;
+    /// @brief Give back the encode buffer if it grew past maxKeptCapacity
+    /// The node pool is bounded (511 nodes) so it is always kept
+    void HuffCompressor::releaseLargeBuffers(size_t maxKeptCapacity) {
+        if (encodedBytes.capacity() > maxKeptCapacity) {
+            encodedBytes.clear();
+            encodedBytes.shrink_to_fit();
+        }
     }
-            
-    void HuffCompressor::destroyTree(HuffmanNode *root) {
-        if (!root) return;
 
-        destroyTree(root->left);
-        destroyTree(root->right);
-        delete root;
+    /// @brief Forget the previous file, keeping the allocated memory
+    void HuffCompressor::reset() {
+        frequencyTable.clear();
+        huffmanCodes.clear();
+        root = nullptr;
     }
     
 }
\ No newline at end of file
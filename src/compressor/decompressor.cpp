@@ -2,10 +2,44 @@
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <cstring>
+#include <limits>
 
 namespace Decompressor {
     
     void HuffDecompressor::decompress (const std::filesystem::path& inputFilePath) {
+        std::ifstream inputFile(inputFilePath, std::ios::binary);
+        if(!inputFile.is_open()) {
+            std::cerr << "Error opening compressed file at: " << inputFilePath << std::endl;
+            exit(1);
+        }
+        inputFile.close();
+        vector<uint8_t> fileData = Utils::readFile(inputFilePath.string());
+
+        string originalFileName;
+        vector<uint8_t> decodedData;
+        try {
+            decompressBuffer(fileData, originalFileName, decodedData);
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << std::endl;
+            exit(1);
+        }
+
+        // Write the decoded data to an output file with the original file name
+        if (!decodedData.empty()) {
+            writeDecodedData(originalFileName, decodedData);
+        } else {
+            std::cerr << "Error decompressing file during write." << std::endl;
+            exit(1);
+        } 
+    }
+
+    /// @brief Decompress in memory - used by decompress and by the daemon, which keeps one decompressor per worker
+    /// Throws std::runtime_error if the data is not a valid compressed file
+    /// @param fileData contents of a .fcm file
+    /// @param originalFileName receives the name of the file that was compressed
+    /// @param decodedData receives the original data. Its capacity is reused
+    void HuffDecompressor::decompressBuffer(const vector<uint8_t>& fileData, string& originalFileName, vector<uint8_t>& decodedData) {
         // Read the data from the compressed file
         // Layout of input file looks like this:
         /**
@@ -26,101 +60,172 @@ namespace Decompressor {
             | compressed data bytes   |  // 0xD7, 0x20, etc.
             +-------------------------+
          */
-        std::ifstream inputFile(inputFilePath, std::ios::binary);
-        if(!inputFile.is_open()) {
-            std::cerr << "Error opening compressed file at: " << inputFilePath << std::endl;
-            exit(1);
-        }
+        frequencyTable.clear();
+        decodedData.clear();
+
+        // The data may come from anywhere (eg a daemon client) so never read past the end
+        size_t offset = 0;
+        auto read = [&](void* destination, size_t size) {
+            if (size > fileData.size() - offset) {
+                throw std::runtime_error("Error: Compressed data is truncated or corrupt.");
+            }
+            std::memcpy(destination, fileData.data() + offset, size);
+            offset += size;
+        };
 
         // Read original file name size and file name
         uint32_t fileNameSize = 0;
-        // read takes a character array and the maximum size of characters to store in said array
-        inputFile.read(reinterpret_cast<char*>(&fileNameSize), sizeof(fileNameSize));
-
-        string originalFileName(fileNameSize, '\0');
-        inputFile.read(reinterpret_cast<char*>(&originalFileName[0]), fileNameSize);
+        read(&fileNameSize, sizeof(fileNameSize));
+        if (fileNameSize > fileData.size() - offset) {
+            throw std::runtime_error("Error: Compressed data is truncated or corrupt.");
+        }
+        originalFileName.assign(fileNameSize, '\0');
+        read(&originalFileName[0], fileNameSize);
 
         // Read frequency table size
         uint32_t tableSize = 0;
-        inputFile.read(reinterpret_cast<char*>(&tableSize), sizeof(tableSize));
+        read(&tableSize, sizeof(tableSize));
 
         // Read frequency table
+        // Building the tree adds frequencies up in int, so their sum has to fit in an int too
+        uint64_t frequencySum = 0;
         for (uint32_t i = 0; i<tableSize; i++) {
             uint8_t byte = 0;
             int frequency = 0;
 
-            inputFile.read(reinterpret_cast<char*>(&byte), sizeof(byte));
-            inputFile.read(reinterpret_cast<char*>(&frequency), sizeof(frequency));
+            read(&byte, sizeof(byte));
+            read(&frequency, sizeof(frequency));
+            frequencySum += static_cast<uint64_t>(frequency);
+            if (frequency < 0 || frequencySum > static_cast<uint64_t>(std::numeric_limits<int>::max())) {
+                throw std::runtime_error("Error: Compressed data has an invalid frequency table.");
+            }
 
             frequencyTable[byte] = frequency;
         }
 
         // Read total bits
         uint32_t totalBits = 0;
-        inputFile.read(reinterpret_cast<char*>(&totalBits), sizeof(totalBits));
+        read(&totalBits, sizeof(totalBits));
 
         // Read compressed data (rest of file)
-        size_t size = (totalBits + 7) / 8; // calculate bytes to store all bits
-        vector<uint8_t> compressedData(size);
-        inputFile.read(reinterpret_cast<char*>(compressedData.data()), size); 
+        size_t size = (static_cast<size_t>(totalBits) + 7) / 8; // calculate bytes to store all bits
+        // zeroed padding at the end - the decode kernel reads a few bytes past the last one
+        compressedData.assign(size + Kernels::INPUT_PADDING, 0);
+        read(compressedData.data(), size);
 
         // Create huffman tree from frequencytable
-        Compressor::HuffCompressor compressor;
-        root = compressor.buildHuffmanTree(frequencyTable);
+        root = treeBuilder.buildHuffmanTree(frequencyTable);
 
         // Decode the compressed data
-        vector<uint8_t> decodedData;
         if (root) {
-            decodedData = decodeCompressedData(totalBits, compressedData);
-            
+            decodeCompressedData(totalBits, compressedData, decodedData);
         } else {
-            std::cerr << "Error decompressing file during decode." << std::endl;
-            exit(1);
+            throw std::runtime_error("Error decompressing file during decode.");
         }
+    }
 
-        // Write the decoded data to an output file with the original file name
-        if (!decodedData.empty()) {
-            writeDecodedData(originalFileName, decodedData);
-        } else {
-            std::cerr << "Error decompressing file during write." << std::endl;
-            exit(1);
-        } 
-        inputFile.close();
+    /// @brief Give back the compressed data copy if it grew past maxKeptCapacity
+    /// The decode table and flattened tree have a fixed upper size so they are always kept
+    void HuffDecompressor::releaseLargeBuffers(size_t maxKeptCapacity) {
+        if (compressedData.capacity() > maxKeptCapacity) {
+            compressedData.clear();
+            compressedData.shrink_to_fit();
+        }
+        treeBuilder.releaseLargeBuffers(maxKeptCapacity);
     }
 
     /// @brief Decode compressed data. 
-    /// Start at the root, read bits, move left if 0 (right if 1), 
-    /// When we reach a leaf node, extract data and append to output, then reset to root and continue decoding
+    /// Looks up the next DECODE_TABLE_BITS bits in a table built from the tree to get the symbol and its code length in one step.
+    /// Codes longer than that continue from the table's node one bit at a time, like walking the tree:
+    /// move left if 0 (right if 1) until we reach a leaf node.
     /// @param totalBits size of compressed data in bits
-    /// @param compressedData actual compressed data
-    /// @return array of decoded data
-    vector<uint8_t> HuffDecompressor::decodeCompressedData(const uint32_t &totalBits, const vector<uint8_t> &compressedData) {
-        vector<uint8_t> decodedData;
+    /// @param compressedData actual compressed data, followed by Kernels::INPUT_PADDING zero bytes
+    /// @param decodedData receives the decoded data
+    void HuffDecompressor::decodeCompressedData(const uint32_t &totalBits, const vector<uint8_t> &compressedData, vector<uint8_t>& decodedData) {
         if (!root) {
             throw std::runtime_error("Huffman tree not initialized!");
         }
-        HuffmanNode* currentNode = root;
-
-        int bitCount = 0;
-        for (uint8_t byte : compressedData) {
-            for (int i = 7; i >= 0; --i) {
-                if (bitCount >= totalBits) { // stop processing if all bits are read - avoid padding buts
-                    return decodedData;
-                }
-                bool bit = (byte >> i) & 1;
-
-                currentNode = bit ? currentNode->right : currentNode->left;
-
-                // If we hit a leaf node, output the symbol
-                // We hit a leaf node if the left and right are null
-                if (!currentNode->left && !currentNode->right) {
-                    decodedData.push_back(currentNode->data);
-                    currentNode = root;
-                }
-                bitCount++;
+        buildDecodeTables();
+
+        // The frequency table says exactly how many symbols there are
+        uint64_t symbolCount = 0;
+        for (const auto &entry : frequencyTable) {
+            symbolCount += static_cast<uint64_t>(entry.second);
+        }
+
+        // A tree that is a single leaf has an empty code - the data is that one byte repeated
+        if (decodeNodes[0].isLeaf) {
+            decodedData.assign(static_cast<size_t>(symbolCount), decodeNodes[0].symbol);
+            return;
+        }
+
+        // Every symbol takes at least one bit, so the data can't be complete
+        if (symbolCount > totalBits) {
+            throw std::runtime_error("Error: Compressed data is truncated or corrupt.");
+        }
+
+        decodedData.resize(static_cast<size_t>(symbolCount));
+        size_t written = Kernels::active().decode(compressedData.data(), totalBits, decodeTable.data(), decodeNodes.data(),
+                                                  decodedData.data(), decodedData.size());
+        if (written != symbolCount) {
+            throw std::runtime_error("Error: Compressed data is truncated or corrupt.");
+        }
+    }
+
+    /// @brief Flatten the tree and fill the lookup table used by the decode kernel
+    void HuffDecompressor::buildDecodeTables() {
+        decodeNodes.clear();
+        decodeTable.assign(size_t(1) << Kernels::DECODE_TABLE_BITS, Kernels::DecodeEntry{0, 0, 0});
+
+        flattenTree(root);
+        // A tree that is a single leaf has no codes - nothing was encoded, so nothing to look up
+        if (!decodeNodes[0].isLeaf) {
+            fillDecodeTable(0, 0, 0);
+        }
+    }
+
+    /// @brief Copy the tree into decodeNodes, children after their parent
+    /// @return index of node in decodeNodes
+    uint16_t HuffDecompressor::flattenTree(HuffmanNode *node) {
+        uint16_t index = static_cast<uint16_t>(decodeNodes.size());
+        decodeNodes.push_back(Kernels::DecodeNode{{0, 0}, node->data, 0});
+
+        if (!node->left && !node->right) {
+            decodeNodes[index].isLeaf = 1;
+            return index;
+        }
+        // push_back may reallocate, so index again after each call instead of holding a reference
+        uint16_t left = flattenTree(node->left);
+        uint16_t right = flattenTree(node->right);
+        decodeNodes[index].child[0] = left;
+        decodeNodes[index].child[1] = right;
+        return index;
+    }
+
+    /// @brief Fill every table slot whose bits start with the code of this node
+    /// @param nodeIndex node in decodeNodes reached by following prefix from the root
+    /// @param prefix bits followed so far
+    /// @param depth number of bits in prefix
+    void HuffDecompressor::fillDecodeTable(uint16_t nodeIndex, uint32_t prefix, unsigned depth) {
+        const Kernels::DecodeNode& node = decodeNodes[nodeIndex];
+        const unsigned tableBits = Kernels::DECODE_TABLE_BITS;
+
+        if (node.isLeaf) {
+            // Code is shorter than the table - every slot starting with it decodes to this symbol
+            uint32_t first = prefix << (tableBits - depth);
+            uint32_t count = uint32_t(1) << (tableBits - depth);
+            for (uint32_t i = 0; i < count; i++) {
+                decodeTable[first + i] = Kernels::DecodeEntry{node.symbol, static_cast<uint8_t>(depth), 1};
             }
+            return;
         }
-        return decodedData;
+        if (depth == tableBits) {
+            // Code is longer than the table - the kernel carries on from this node
+            decodeTable[prefix] = Kernels::DecodeEntry{nodeIndex, static_cast<uint8_t>(depth), 0};
+            return;
+        }
+        fillDecodeTable(node.child[0], prefix << 1, depth + 1);
+        fillDecodeTable(node.child[1], (prefix << 1) | 1, depth + 1);
     }
 
     void HuffDecompressor::writeDecodedData(const string& input_file_name, const vector<uint8_t> &decodedData) {
@@ -133,12 +238,4 @@ namespace Decompressor {
         outputFile.close();
         std::cout << "Decoded data written to: " << input_file_name << std::endl;
     }
-
-    void HuffDecompressor::destroyTree(HuffmanNode *root) {
-        if (!root) return;
-
-        destroyTree(root->left);
-        destroyTree(root->right);
-        delete root;
-    }
 }
\ No newline at end of file
@@ -1,28 +1,349 @@
 #include "images.h"
+#include <fstream>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <map>
 
 namespace Compressor {
 
     /// @brief Compress image sizes
     /// @param filePath Path to the image to compress
-    void ImageCompressor::compress(const std::filesystem::path& filePath) {
-        // imread takes a filename
-        string fileName = filePath.filename().string();
-        image = cv::imread(filePath.string());
-        if (!image.data) {
-            std::cerr << "Error: Could not open or find the image." << std::endl;
-            return;
+    /// @return true if the compressed image was written
+    bool ImageCompressor::compress(const std::filesystem::path& filePath) {
+        ImageBuffers buffers;
+        ImageResult result;
+
+        if (!compressOne(filePath, buffers, result)) {
+            return false;
+        }
+
+        std::cout << "Compressed image saved as: " << outputPathFor(filePath).string() << std::endl;
+        if (options.targetSize > 0) {
+            std::cout << "Size: " << result.bytesIn << " -> " << result.bytesOut << " bytes"
+                      << " (target " << options.targetSize << ", " << (result.targetMet ? "met" : "missed") << ")" << std::endl;
+            std::cout << "Quality: " << result.quality << ", scale: " << result.scale
+                      << ", trial encodes: " << result.trials << std::endl;
+        }
+        std::cout << "Done." << std::endl;
+        return true;
+    }
+
+    /// @brief Compress many images at once
+    /// Every worker runs the whole read -> decode -> encode -> write pipeline on its own image, so while one
+    /// thread is waiting on the disk the others are decoding or encoding. Each worker keeps its read and
+    /// encode buffers for the whole run so they only grow to the size of the largest image it has seen.
+    /// @param filePaths images to compress
+    /// @return true if every image was compressed
+    bool ImageCompressor::compressBatch(const vector<std::filesystem::path>& filePaths) {
+        if (filePaths.empty()) {
+            std::cerr << "Error: No images found to compress." << std::endl;
+            return false;
         }
 
-        // Set jpeg compression quality (1-100, lower = higher compression)
-        vector<int> compression_params;
-        compression_params.push_back(cv::IMWRITE_JPEG_QUALITY);
-        compression_params.push_back(15);
+        // Outputs are named after the file stem only, so a.jpg / a.png or x/a.jpg / y/a.jpg would overwrite each other
+        if (!checkOutputPaths(filePaths)) {
+            return false;
+        }
+
+        unsigned int threadCount = options.threads ? options.threads : std::thread::hardware_concurrency();
+        if (threadCount == 0) threadCount = 1;
+        if (threadCount > filePaths.size()) threadCount = static_cast<unsigned int>(filePaths.size());
+
+        // We already run one image per thread - stop opencv from spawning its own threads on top of that
+        cv::setNumThreads(1);
+
+        std::atomic<size_t> nextIndex{0};
+        std::atomic<size_t> succeeded{0};
+        std::atomic<size_t> totalBytesIn{0};
+        std::atomic<size_t> totalBytesOut{0};
+        std::atomic<size_t> totalTrials{0};
+        std::atomic<size_t> targetsMissed{0};
+
+        auto start = std::chrono::steady_clock::now();
+
+        vector<std::thread> workers;
+        for (unsigned int t = 0; t < threadCount; t++) {
+            workers.emplace_back([&]() {
+                ImageBuffers buffers;
+                size_t i;
+                while ((i = nextIndex.fetch_add(1)) < filePaths.size()) {
+                    ImageResult result;
+                    if (compressOne(filePaths[i], buffers, result)) {
+                        succeeded++;
+                        totalBytesIn += result.bytesIn;
+                        totalBytesOut += result.bytesOut;
+                        totalTrials += result.trials;
+                        if (!result.targetMet) targetsMissed++;
+                    }
+                }
+            });
+        }
+        for (auto &worker : workers) {
+            worker.join();
+        }
 
-        string compressedFilename = filePath.stem().string() + "_compressed.jpg";
-        cv::imwrite(compressedFilename, image, compression_params);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        size_t done = succeeded.load();
+        size_t failed = filePaths.size() - done;
 
-        std::cout << "Compressed image saved as: " << compressedFilename << std::endl;
+        std::cout << "Compressed " << done << " of " << filePaths.size() << " images"
+                  << " using " << threadCount << " threads in " << seconds << " s" << std::endl;
+        if (seconds > 0) {
+            std::cout << "Throughput: " << done / seconds << " images/s" << std::endl;
+        }
+        std::cout << "Total size: " << totalBytesIn.load() << " -> " << totalBytesOut.load() << " bytes" << std::endl;
+        if (options.targetSize > 0 && done > 0) {
+            std::cout << "Target size " << options.targetSize << " bytes met by " << done - targetsMissed.load()
+                      << " of " << done << " images, " << static_cast<double>(totalTrials.load()) / done
+                      << " trial encodes per image" << std::endl;
+        }
+        if (failed > 0) {
+            std::cerr << failed << " images could not be compressed." << std::endl;
+        }
         std::cout << "Done." << std::endl;
+        return failed == 0;
+    }
+
+    /// @brief Build the list of images for a batch
+    /// @param input Either a directory (every image directly inside it is used) or a text file with one image path per line
+    /// @return paths of the images to compress, sorted for a stable order
+    vector<std::filesystem::path> ImageCompressor::collectImagePaths(const std::filesystem::path& input) {
+        vector<std::filesystem::path> paths;
+        std::error_code ec;
+
+        if (std::filesystem::is_directory(input, ec)) {
+            const vector<string> imageExtensions = {".jpg", ".jpeg", ".png", ".bmp", ".webp", ".tif", ".tiff"};
+            for (const auto &entry : std::filesystem::directory_iterator(input, ec)) {
+                if (!entry.is_regular_file()) continue;
+
+                string extension = entry.path().extension().string();
+                std::transform(extension.begin(), extension.end(), extension.begin(),
+                               [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+                if (std::find(imageExtensions.begin(), imageExtensions.end(), extension) != imageExtensions.end()) {
+                    paths.push_back(entry.path());
+                }
+            }
+            std::sort(paths.begin(), paths.end());
+        } else {
+            std::ifstream listFile(input);
+            if (!listFile.is_open()) {
+                std::cerr << "Error opening image list: " << input << std::endl;
+                return paths;
+            }
+            string line;
+            while (std::getline(listFile, line)) {
+                // tolerate windows line endings and blank lines
+                if (!line.empty() && line.back() == '\r') line.pop_back();
+                if (line.empty()) continue;
+                paths.emplace_back(line);
+            }
+        }
+        return paths;
+    }
+
+    /// @brief Make sure no two images of a batch would be written to the same output file
+    /// @return false (after listing every clash) if any two inputs share an output path
+    bool ImageCompressor::checkOutputPaths(const vector<std::filesystem::path>& filePaths) const {
+        std::map<string, const std::filesystem::path*> outputs;
+        bool unique = true;
+
+        for (const auto &filePath : filePaths) {
+            std::error_code ec;
+            std::filesystem::path outputPath = outputPathFor(filePath);
+            std::filesystem::path absolutePath = std::filesystem::absolute(outputPath, ec);
+            string key = (ec ? outputPath : absolutePath).lexically_normal().string();
+#ifdef _WIN32
+            // windows file names are case insensitive
+            std::transform(key.begin(), key.end(), key.begin(),
+                           [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+#endif
+            auto inserted = outputs.emplace(key, &filePath);
+            if (!inserted.second) {
+                std::cerr << "Error: " << inserted.first->second->string() << " and " << filePath.string()
+                          << " would both be saved as " << outputPath.string() << std::endl;
+                unique = false;
+            }
+        }
+        if (!unique) {
+            std::cerr << "Rename the clashing images or compress them in separate runs with different --output-dir." << std::endl;
+        }
+        return unique;
+    }
+
+    /// @brief Read, decode, re-encode and write a single image using the caller's buffers
+    /// Safe to call from several threads at once as long as each thread passes its own buffers
+    /// @return true if the compressed image was written
+    bool ImageCompressor::compressOne(const std::filesystem::path& filePath, ImageBuffers& buffers, ImageResult& result) {
+        vector<uint8_t>& readBuffer = buffers.read;
+        std::ifstream inputFile(filePath, std::ios::binary | std::ios::ate);
+        if (!inputFile.is_open()) {
+            std::cerr << "Error: Could not open or find the image: " << filePath.string() << std::endl;
+            return false;
+        }
+        std::streamoff fileSize = inputFile.tellg();
+        if (fileSize <= 0) {
+            std::cerr << "Error: Empty image file: " << filePath.string() << std::endl;
+            return false;
+        }
+        readBuffer.resize(static_cast<size_t>(fileSize));
+        inputFile.seekg(0, std::ios::beg);
+        if (!inputFile.read(reinterpret_cast<char*>(readBuffer.data()), fileSize)) {
+            std::cerr << "Error: Could not read the image: " << filePath.string() << std::endl;
+            return false;
+        }
+        inputFile.close();
+
+        // opencv reports some failures (corrupt data, unsupported parameters) by throwing instead of returning false
+        try {
+            // Wrap the raw bytes without copying and decode
+            cv::Mat raw(1, static_cast<int>(readBuffer.size()), CV_8UC1, readBuffer.data());
+            cv::Mat image = cv::imdecode(raw, cv::IMREAD_COLOR);
+            if (!image.data) {
+                std::cerr << "Error: Could not decode the image: " << filePath.string() << std::endl;
+                return false;
+            }
+
+            // imencode reuses the buffer's capacity from the previous image
+            if (options.targetSize > 0) {
+                if (!encodeToTarget(image, buffers, result)) {
+                    std::cerr << "Error: Could not encode the image as " << options.format << ": " << filePath.string() << std::endl;
+                    return false;
+                }
+            } else {
+                if (!cv::imencode("." + options.format, image, buffers.encoded, encodeParams(options.quality))) {
+                    std::cerr << "Error: Could not encode the image as " << options.format << ": " << filePath.string() << std::endl;
+                    return false;
+                }
+                result.quality = options.quality;
+                result.trials = 1;
+            }
+        } catch (const cv::Exception& e) {
+            std::cerr << "Error: Could not compress the image: " << filePath.string() << ": " << e.what() << std::endl;
+            return false;
+        }
+        const vector<uchar>& encodeBuffer = buffers.encoded;
+
+        std::filesystem::path outputPath = outputPathFor(filePath);
+        std::ofstream outputFile(outputPath, std::ios::binary);
+        if (!outputFile.is_open() ||
+            !outputFile.write(reinterpret_cast<const char*>(encodeBuffer.data()), encodeBuffer.size())) {
+            std::cerr << "Error: Could not write the compressed image: " << outputPath.string() << std::endl;
+            return false;
+        }
+
+        result.bytesIn = readBuffer.size();
+        result.bytesOut = encodeBuffer.size();
+        return true;
+    }
+
+    /// @brief Find the highest quality whose encoding fits in options.targetSize
+    /// The image is only decoded once - every candidate is encoded in memory from the same cv::Mat.
+    /// Try the top quality first (images that already fit cost one encode), then the bottom, then binary search
+    /// in between. If even minQuality is too big and downscaling is allowed, shrink the image by the square root of
+    /// the overshoot (file size grows roughly with pixel count) and search again. Stops after options.maxTrials encodes.
+    /// @param image decoded image
+    /// @param buffers buffers.encoded ends up with the best fitting candidate, or the smallest one if none fit
+    /// @param result receives the chosen quality, scale and number of trial encodes
+    /// @return false if the encoder failed
+    bool ImageCompressor::encodeToTarget(const cv::Mat& image, ImageBuffers& buffers, ImageResult& result) {
+        buffers.encoded.clear();
+        result.trials = 0;
+        result.targetMet = false;
+
+        cv::Mat scaled = image;
+        double scale = 1.0;
+        bool encodeFailed = false;
+
+        // Encode at quality q, keep it in buffers.encoded if it is the best so far. Returns whether it fits.
+        auto tryQuality = [&](int q, size_t& encodedSize) -> bool {
+            if (!cv::imencode("." + options.format, scaled, buffers.trial, encodeParams(q))) {
+                encodeFailed = true;
+                return false;
+            }
+            result.trials++;
+            encodedSize = buffers.trial.size();
+            bool fits = encodedSize <= options.targetSize;
+
+            bool better = fits ? (!result.targetMet || q > result.quality)
+                               : (!result.targetMet && (buffers.encoded.empty() || encodedSize < buffers.encoded.size()));
+            if (better) {
+                std::swap(buffers.encoded, buffers.trial);
+                result.quality = q;
+                result.scale = scale;
+                result.targetMet = fits;
+            }
+            return fits;
+        };
+
+        while (!encodeFailed && result.trials < options.maxTrials) {
+            int lo = options.minQuality;
+            int hi = options.quality;
+            size_t encodedSize = 0;
+
+            if (tryQuality(hi, encodedSize)) return true;
+            if (encodeFailed) return false;
+            hi--;
+
+            size_t smallestSize = encodedSize;
+            if (lo <= hi && result.trials < options.maxTrials) {
+                bool fits = tryQuality(lo, encodedSize);
+                if (encodeFailed) return false;
+                smallestSize = encodedSize;
+                if (fits) {
+                    lo++;
+                    while (lo <= hi && result.trials < options.maxTrials) {
+                        int mid = lo + (hi - lo) / 2;
+                        if (tryQuality(mid, encodedSize)) {
+                            lo = mid + 1;
+                        } else {
+                            hi = mid - 1;
+                        }
+                        if (encodeFailed) return false;
+                    }
+                    return true;
+                }
+            }
+
+            // Nothing fits at this size
+            if (!options.allowDownscale) break;
+
+            // a little headroom so the next round doesn't land just over the budget
+            scale *= std::sqrt(static_cast<double>(options.targetSize) / smallestSize) * 0.95;
+            int width = std::max(1, static_cast<int>(image.cols * scale));
+            int height = std::max(1, static_cast<int>(image.rows * scale));
+            if (width == scaled.cols && height == scaled.rows) break;
+            cv::resize(image, scaled, cv::Size(width, height), 0, 0, cv::INTER_AREA);
+        }
+        return !encodeFailed && !buffers.encoded.empty();
+    }
+
+    /// @brief Encoder parameters for the configured output format
+    vector<int> ImageCompressor::encodeParams(int quality) const {
+        vector<int> params;
+        if (options.format == "jpg" || options.format == "jpeg") {
+            // Set jpeg compression quality (1-100, lower = higher compression)
+            params.push_back(cv::IMWRITE_JPEG_QUALITY);
+            params.push_back(quality);
+        } else if (options.format == "webp") {
+            params.push_back(cv::IMWRITE_WEBP_QUALITY);
+            params.push_back(quality);
+        }
+        // png and the other lossless formats have no quality - they keep opencv's default settings,
+        // which favour speed over squeezing out the last few bytes
+        return params;
+    }
+
+    /// @brief <outputDir>/<original_file_name>_compressed.<format>
+    std::filesystem::path ImageCompressor::outputPathFor(const std::filesystem::path& filePath) const {
+        string compressedFilename = filePath.stem().string() + "_compressed." + options.format;
+        if (options.outputDir.empty()) {
+            return compressedFilename;
+        }
+        return options.outputDir / compressedFilename;
     }
 
-}
\ No newline at end of file
+}
@@ -0,0 +1,35 @@
+#include "daemon.h"
+#include <cstring>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace Daemon {
+
+    /// @brief Send one request to the server and wait for its reply
+    /// @return false if the server could not be reached or hung up - the reply status says whether the request worked
+    bool FcmpClient::send(const Message& request, Message& reply) {
+        sockaddr_un address{};
+        if (socketPath.empty() || socketPath.size() >= sizeof(address.sun_path)) {
+            return false;
+        }
+        address.sun_family = AF_UNIX;
+        std::memcpy(address.sun_path, socketPath.c_str(), socketPath.size() + 1);
+
+        int socketFd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (socketFd < 0) {
+            return false;
+        }
+        if (connect(socketFd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0) {
+            close(socketFd);
+            return false;
+        }
+
+        // A busy server replies and hangs up without reading the request, so look for a reply even if sending failed
+        writeMessage(socketFd, request);
+        bool received = readMessage(socketFd, reply, MAX_REPLY_PAYLOAD_SIZE) == ReadResult::Ok;
+        close(socketFd);
+        return received;
+    }
+}
@@ -0,0 +1,75 @@
+#include "daemon.h"
+#include <cstring>
+#include <cerrno>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+namespace Daemon {
+
+    namespace {
+        // code + nameSize + payloadSize
+        constexpr size_t HEADER_SIZE = sizeof(uint8_t) + sizeof(uint32_t) + sizeof(uint64_t);
+
+        bool receiveAll(int socketFd, void* data, size_t size) {
+            uint8_t* bytes = static_cast<uint8_t*>(data);
+            while (size > 0) {
+                ssize_t received = recv(socketFd, bytes, size, 0);
+                if (received < 0 && errno == EINTR) continue;
+                if (received <= 0) return false;
+                bytes += received;
+                size -= static_cast<size_t>(received);
+            }
+            return true;
+        }
+
+        bool sendAll(int socketFd, const void* data, size_t size) {
+            const uint8_t* bytes = static_cast<const uint8_t*>(data);
+            while (size > 0) {
+#ifdef MSG_NOSIGNAL
+                ssize_t sent = ::send(socketFd, bytes, size, MSG_NOSIGNAL);
+#else
+                ssize_t sent = ::send(socketFd, bytes, size, 0);
+#endif
+                if (sent < 0 && errno == EINTR) continue;
+                if (sent <= 0) return false;
+                bytes += sent;
+                size -= static_cast<size_t>(sent);
+            }
+            return true;
+        }
+    }
+
+    /// @brief Read one message, reusing the capacity of message.name and message.payload
+    /// @return ReadResult::TooLarge if the header announces a name or payload over the limits
+    ReadResult readMessage(int socketFd, Message& message, uint64_t maxPayloadSize) {
+        uint8_t header[HEADER_SIZE];
+        if (!receiveAll(socketFd, header, sizeof(header))) return ReadResult::Closed;
+
+        uint32_t nameSize = 0;
+        uint64_t payloadSize = 0;
+        message.code = header[0];
+        std::memcpy(&nameSize, header + 1, sizeof(nameSize));
+        std::memcpy(&payloadSize, header + 1 + sizeof(nameSize), sizeof(payloadSize));
+
+        if (nameSize > MAX_NAME_SIZE || payloadSize > maxPayloadSize) return ReadResult::TooLarge;
+
+        message.name.resize(nameSize);
+        message.payload.resize(static_cast<size_t>(payloadSize));
+        bool received = receiveAll(socketFd, &message.name[0], nameSize) &&
+                        receiveAll(socketFd, message.payload.data(), message.payload.size());
+        return received ? ReadResult::Ok : ReadResult::Closed;
+    }
+
+    bool writeMessage(int socketFd, const Message& message) {
+        uint8_t header[HEADER_SIZE];
+        uint32_t nameSize = static_cast<uint32_t>(message.name.size());
+        uint64_t payloadSize = message.payload.size();
+        header[0] = message.code;
+        std::memcpy(header + 1, &nameSize, sizeof(nameSize));
+        std::memcpy(header + 1 + sizeof(nameSize), &payloadSize, sizeof(payloadSize));
+
+        return sendAll(socketFd, header, sizeof(header)) &&
+               sendAll(socketFd, message.name.data(), message.name.size()) &&
+               sendAll(socketFd, message.payload.data(), message.payload.size());
+    }
+}
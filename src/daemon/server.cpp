@@ -0,0 +1,294 @@
+#include "daemon.h"
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <filesystem>
+#include <csignal>
+#include <cerrno>
+#include <cstring>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include "utils.h"
+
+namespace Daemon {
+
+    namespace {
+        std::atomic<bool> stopRequested{false};
+
+        void onStopSignal(int) {
+            stopRequested = true;
+        }
+
+        // Buffers keep their capacity between requests, but one huge request shouldn't pin that memory forever
+        constexpr size_t MAX_KEPT_CAPACITY = size_t(64) << 20;
+
+        template <typename Buffer>
+        void trimBuffer(Buffer& buffer) {
+            if (buffer.capacity() > MAX_KEPT_CAPACITY) {
+                buffer.clear();
+                buffer.shrink_to_fit();
+            }
+        }
+
+        // A worker stuck on a client that stopped sending is a worker lost to everyone else
+        void setSocketTimeouts(int socketFd, int seconds) {
+            timeval timeout{};
+            timeout.tv_sec = seconds;
+            setsockopt(socketFd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+            setsockopt(socketFd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        }
+
+        // A stale socket file refuses connections, a live one accepts them
+        bool isServerListening(const sockaddr_un& address) {
+            int probeFd = socket(AF_UNIX, SOCK_STREAM, 0);
+            if (probeFd < 0) {
+                return false;
+            }
+            bool listening = connect(probeFd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == 0;
+            close(probeFd);
+            return listening;
+        }
+    }
+
+    /// @brief Listen on options.socketPath until SIGINT / SIGTERM
+    /// Connections are queued for a fixed pool of workers; each connection carries one request and its reply.
+    /// @return process exit code
+    int FcmpServer::run() {
+        sockaddr_un address{};
+        if (options.socketPath.empty() || options.socketPath.size() >= sizeof(address.sun_path)) {
+            std::cerr << "Error: Socket path must be set and shorter than " << sizeof(address.sun_path) << " characters." << std::endl;
+            return 1;
+        }
+        address.sun_family = AF_UNIX;
+        std::memcpy(address.sun_path, options.socketPath.c_str(), options.socketPath.size() + 1);
+
+        // A socket file left behind by a previous server that didn't shut down cleanly
+        std::error_code ec;
+        if (std::filesystem::exists(options.socketPath, ec)) {
+            if (!std::filesystem::is_socket(options.socketPath, ec)) {
+                std::cerr << "Error: " << options.socketPath << " exists and is not a socket." << std::endl;
+                return 1;
+            }
+            // Only remove it if nothing answers - otherwise we would steal the path from a running server
+            if (isServerListening(address)) {
+                std::cerr << "Error: Another server is already listening on " << options.socketPath << "." << std::endl;
+                return 1;
+            }
+            std::filesystem::remove(options.socketPath, ec);
+        }
+
+        int listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listenFd < 0) {
+            std::cerr << "Error creating socket: " << std::strerror(errno) << std::endl;
+            return 1;
+        }
+        if (bind(listenFd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 ||
+            listen(listenFd, static_cast<int>(std::min<size_t>(options.maxQueue, SOMAXCONN))) < 0) {
+            std::cerr << "Error listening on " << options.socketPath << ": " << std::strerror(errno) << std::endl;
+            close(listenFd);
+            return 1;
+        }
+
+        // Clients that hang up early must not kill the server
+        std::signal(SIGPIPE, SIG_IGN);
+        std::signal(SIGINT, onStopSignal);
+        std::signal(SIGTERM, onStopSignal);
+
+        unsigned int workerCount = options.workers ? options.workers : std::thread::hardware_concurrency();
+        if (workerCount == 0) workerCount = 1;
+
+        vector<std::thread> workers;
+        for (unsigned int i = 0; i < workerCount; i++) {
+            workers.emplace_back(&FcmpServer::workerLoop, this);
+        }
+
+        std::cout << "Listening on " << options.socketPath << " with " << workerCount << " workers"
+                  << " (queue up to " << options.maxQueue << " connections)" << std::endl;
+
+        Message busyReply;
+        busyReply.code = static_cast<uint8_t>(Status::Busy);
+        const string busyMessage = "Server busy, try again later.";
+        busyReply.payload.assign(busyMessage.begin(), busyMessage.end());
+
+        while (!stopRequested) {
+            // Wake up now and then to notice a stop signal
+            pollfd listenPoll{listenFd, POLLIN, 0};
+            int ready = poll(&listenPoll, 1, 250);
+            if (ready <= 0) continue;
+
+            int clientFd = accept(listenFd, nullptr, nullptr);
+            if (clientFd < 0) continue;
+
+            bool queued = false;
+            {
+                std::lock_guard<std::mutex> lock(queueMutex);
+                if (pendingConnections.size() < options.maxQueue) {
+                    pendingConnections.push_back(clientFd);
+                    queued = true;
+                }
+            }
+
+            if (queued) {
+                queueReady.notify_one();
+            } else {
+                setSocketTimeouts(clientFd, 1);
+                writeMessage(clientFd, busyReply);
+                close(clientFd);
+            }
+        }
+
+        std::cout << "Stopping..... " << std::endl;
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            stopping = true;
+        }
+        queueReady.notify_all();
+
+        // Workers finish whatever is already queued before they return
+        for (auto &worker : workers) {
+            worker.join();
+        }
+        close(listenFd);
+        std::filesystem::remove(options.socketPath, ec);
+
+        std::cout << "Done." << std::endl;
+        return 0;
+    }
+
+    void FcmpServer::workerLoop() {
+        // One coder context per worker for the life of the server - nodes, tables and buffers are all reused
+        WorkerContext context;
+
+        while (true) {
+            int clientFd = -1;
+            {
+                std::unique_lock<std::mutex> lock(queueMutex);
+                queueReady.wait(lock, [this]() { return stopping || !pendingConnections.empty(); });
+                if (pendingConnections.empty()) return;
+                clientFd = pendingConnections.front();
+                pendingConnections.pop_front();
+            }
+
+            handleConnection(clientFd, context);
+            close(clientFd);
+        }
+    }
+
+    void FcmpServer::handleConnection(int clientFd, WorkerContext& context) {
+        setSocketTimeouts(clientFd, 30);
+
+        ReadResult received = readMessage(clientFd, context.request, options.maxPayloadSize);
+        if (received == ReadResult::TooLarge) {
+            // Tell the client why before hanging up - the rest of its request is never read
+            Message& reply = context.reply;
+            reply.code = static_cast<uint8_t>(Status::Error);
+            reply.name.clear();
+            string message = "Error: Request too large, payloads are limited to " + std::to_string(options.maxPayloadSize) +
+                             " bytes and names to " + std::to_string(MAX_NAME_SIZE) + " bytes.";
+            reply.payload.assign(message.begin(), message.end());
+            writeMessage(clientFd, reply);
+            return;
+        }
+        if (received != ReadResult::Ok) {
+            return;
+        }
+
+        handleRequest(context);
+        writeMessage(clientFd, context.reply);
+
+        trimBuffer(context.request.payload);
+        trimBuffer(context.reply.payload);
+        trimBuffer(context.fileBuffer);
+        context.compressor.releaseLargeBuffers(MAX_KEPT_CAPACITY);
+        context.decompressor.releaseLargeBuffers(MAX_KEPT_CAPACITY);
+    }
+
+    /// @brief Run context.request and fill context.reply
+    void FcmpServer::handleRequest(WorkerContext& context) {
+        const Message& request = context.request;
+        Message& reply = context.reply;
+
+        reply.code = static_cast<uint8_t>(Status::Ok);
+        reply.name.clear();
+        reply.payload.clear();
+
+        // Files are held in memory just like inline payloads, so they get the same size limit
+        auto readInputFile = [&](const std::filesystem::path& inputPath) {
+            std::error_code ec;
+            uintmax_t fileSize = std::filesystem::file_size(inputPath, ec);
+            if (ec) {
+                throw std::runtime_error("Error reading file: " + inputPath.string());
+            }
+            if (fileSize > options.maxPayloadSize) {
+                throw std::runtime_error("Error: " + inputPath.string() + " is too large, the limit is " +
+                                         std::to_string(options.maxPayloadSize) + " bytes.");
+            }
+            if (!Utils::tryReadFile(inputPath.string(), context.fileBuffer)) {
+                throw std::runtime_error("Error reading file: " + inputPath.string());
+            }
+        };
+
+        try {
+            switch (static_cast<Op>(request.code)) {
+                case Op::Compress: {
+                    context.compressor.compressToBuffer(request.name, request.payload, reply.payload);
+                    reply.name = Compressor::HuffCompressor::compressedPathFor(request.name).filename().string();
+                    break;
+                }
+                case Op::Decompress: {
+                    context.decompressor.decompressBuffer(request.payload, reply.name, reply.payload);
+                    break;
+                }
+                case Op::CompressFile: {
+                    std::filesystem::path inputPath(request.name);
+                    readInputFile(inputPath);
+                    context.compressor.compressToBuffer(inputPath.filename().string(), context.fileBuffer, reply.payload);
+
+                    std::filesystem::path outputPath = Compressor::HuffCompressor::compressedPathFor(inputPath);
+                    if (!Utils::writeFile(outputPath.string(), reply.payload)) {
+                        throw std::runtime_error("Error writing file: " + outputPath.string());
+                    }
+                    reply.name = outputPath.string();
+                    reply.payload.clear();
+                    break;
+                }
+                case Op::DecompressFile: {
+                    std::filesystem::path inputPath(request.name);
+                    readInputFile(inputPath);
+                    string originalFileName;
+                    context.decompressor.decompressBuffer(context.fileBuffer, originalFileName, reply.payload);
+                    if (reply.payload.empty()) {
+                        throw std::runtime_error("Error decompressing file during write.");
+                    }
+
+                    // The server has no useful working directory - restore next to the compressed file.
+                    // Only the file name part of the stored name is used so a crafted file can't write elsewhere
+                    string safeName = std::filesystem::path(originalFileName).filename().string();
+                    if (safeName.empty()) {
+                        throw std::runtime_error("Error: Compressed file has no original file name.");
+                    }
+                    std::filesystem::path outputPath = inputPath.parent_path() / safeName;
+                    if (!Utils::writeFile(outputPath.string(), reply.payload)) {
+                        throw std::runtime_error("Error writing file: " + outputPath.string());
+                    }
+                    reply.name = outputPath.string();
+                    reply.payload.clear();
+                    break;
+                }
+                default:
+                    throw std::runtime_error("Unknown request.");
+            }
+        } catch (const std::exception& e) {
+            reply.code = static_cast<uint8_t>(Status::Error);
+            reply.name.clear();
+            string message = e.what();
+            reply.payload.assign(message.begin(), message.end());
+        }
+    }
+}
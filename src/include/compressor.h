@@ -47,24 +47,33 @@ namespace Compressor {
 
         public:
             explicit HuffCompressor() : root(nullptr) {}
-            ~HuffCompressor() {
-                // Since it's called in destructor, no need to call explicitly
-                destroyTree(root);
-            }
 
             void compress (const std::filesystem::path& outputFilePath, const vector<uint8_t> file_input);
+            void compressToBuffer(const string& fileName, const vector<uint8_t>& input, vector<uint8_t>& output);
             HuffmanNode* buildHuffmanTree(const std::optional<unordered_map<uint8_t, int>>& receivedFrequencyTable);
             void printHuffmanTree(HuffmanNode* node, const std::string& code);
 
+            // Free the reused buffers that grew past maxKeptCapacity, so one huge file doesn't pin its memory
+            void releaseLargeBuffers(size_t maxKeptCapacity);
+
+            static std::filesystem::path compressedPathFor(const std::filesystem::path& inputFilePath);
+
         private:
             void buildFrequencyTable(const vector<uint8_t>& input);     
             void generateHuffmanCodes(HuffmanNode *node, const string& code);
-            pair<vector<uint8_t>, int> encodeData(const vector<uint8_t> &data);
-            void writeCompressedData(const std::filesystem::path& input_file_path, pair<vector<uint8_t>, int>& encodedData);
-            void destroyTree(HuffmanNode *root);  
+            uint32_t encodeData(const vector<uint8_t> &data, vector<uint8_t>& byteArray);
+            void writeCompressedData(const string& fileName, uint32_t totalBits, const vector<uint8_t>& encodedData, vector<uint8_t>& outputFileBuffer);
+            void reset();
 
             unordered_map<uint8_t, int> frequencyTable;
             unordered_map<uint8_t, string> huffmanCodes;
             HuffmanNode* root = nullptr;
+
+            // Every node of the current tree - a tree never has more than 256 leaves + 255 internal nodes,
+            // so after the first reserve nodes never move and the memory is reused by the next tree.
+            // Building a new tree frees the previous one.
+            vector<HuffmanNode> nodePool;
+            // Reused between calls so a long lived compressor doesn't allocate per file
+            vector<uint8_t> encodedBytes;
     };
 }
\ No newline at end of file
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+#include "compressor.h"
+#include "decompressor.h"
+
+using std::string;
+using std::vector;
+
+// fcmp serve / fcmp client - a long running fcmp listening on a unix domain socket, so callers
+// don't pay process startup and cold allocations for every file
+namespace Daemon {
+
+    enum class Op : uint8_t {
+        Compress = 1,           // payload is the data, name is its file name. Reply payload is the .fcm data
+        Decompress = 2,         // payload is .fcm data. Reply name is the original file name, payload the data
+        CompressFile = 3,       // name is a path the server can read. Reply name is the path it wrote
+        DecompressFile = 4,     // name is a path the server can read. Reply name is the path it wrote
+    };
+
+    enum class Status : uint8_t {
+        Ok = 0,
+        Error = 1,              // payload is the error message
+        Busy = 2,               // queue full, try again later
+    };
+
+    // Requests and replies have the same layout:
+    //  +-------------------------+
+    //  | code (uint8_t)          |  // Op for requests, Status for replies
+    //  | nameSize (uint32_t)     |
+    //  | payloadSize (uint64_t)  |
+    //  +-------------------------+
+    //  | name                    |
+    //  | payload                 |
+    //  +-------------------------+
+    struct Message {
+        uint8_t code = 0;
+        string name;
+        vector<uint8_t> payload;
+    };
+
+    // Longest name accepted in a message
+    constexpr uint32_t MAX_NAME_SIZE = 4096;
+    // Biggest reply payload a client accepts - decompressed data never exceeds INT_MAX bytes
+    // and compressed data never exceeds 2^32 bits plus the header
+    constexpr uint64_t MAX_REPLY_PAYLOAD_SIZE = 1ull << 31;
+
+    enum class ReadResult {
+        Ok,
+        Closed,                 // connection closed or failed before the whole message arrived
+        TooLarge,               // header read, but the name or payload is over the limit - nothing else was read
+    };
+
+    ReadResult readMessage(int socketFd, Message& message, uint64_t maxPayloadSize);
+    bool writeMessage(int socketFd, const Message& message);
+
+    struct ServerOptions {
+        string socketPath;
+        unsigned int workers = 0;               // jobs run at once - 0 = one per hardware thread
+        size_t maxQueue = 64;                   // connections waiting for a worker before new ones get Busy
+        uint64_t maxPayloadSize = 256ull << 20; // biggest input accepted - inline payload or file the server reads
+    };
+
+    class FcmpServer {
+
+        public:
+            explicit FcmpServer(const ServerOptions& options) : options(options) {}
+
+            int run();
+
+        private:
+            // Everything a worker reuses from one request to the next
+            struct WorkerContext {
+                Compressor::HuffCompressor compressor;
+                Decompressor::HuffDecompressor decompressor;
+                Message request;
+                Message reply;
+                vector<uint8_t> fileBuffer;
+            };
+
+            void workerLoop();
+            void handleConnection(int clientFd, WorkerContext& context);
+            void handleRequest(WorkerContext& context);
+
+            ServerOptions options;
+
+            std::mutex queueMutex;
+            std::condition_variable queueReady;
+            std::deque<int> pendingConnections;
+            bool stopping = false;
+    };
+
+    class FcmpClient {
+
+        public:
+            explicit FcmpClient(const string& socketPath) : socketPath(socketPath) {}
+
+            bool send(const Message& request, Message& reply);
+
+        private:
+            string socketPath;
+    };
+}
@@ -7,6 +7,7 @@
 #include <filesystem>
 #include "utils.h"
 #include "compressor.h"
+#include "kernels.h"
 
 namespace Decompressor {
 
@@ -21,19 +22,28 @@ namespace Decompressor {
 
         public:
             HuffDecompressor() : root(nullptr) {}
-            ~HuffDecompressor() {
-                // Since it's called in destructor, no need to call explicitly
-                destroyTree(root);
-            }
 
             void decompress (const std::filesystem::path& inputFilePath);
+            void decompressBuffer(const vector<uint8_t>& fileData, string& originalFileName, vector<uint8_t>& decodedData);
+            // Free the reused buffers that grew past maxKeptCapacity, so one huge file doesn't pin its memory
+            void releaseLargeBuffers(size_t maxKeptCapacity);
 
         private:
-            vector<uint8_t> decodeCompressedData(const uint32_t &totalBits, const vector<uint8_t> &compressedData);
+            void decodeCompressedData(const uint32_t &totalBits, const vector<uint8_t> &compressedData, vector<uint8_t>& decodedData);
+            void buildDecodeTables();
+            uint16_t flattenTree(HuffmanNode *node);
+            void fillDecodeTable(uint16_t nodeIndex, uint32_t prefix, unsigned depth);
             void writeDecodedData(const string& input_file_name, const vector<uint8_t> &decodedData);
-            void destroyTree(HuffmanNode *root);
 
             unordered_map<uint8_t, int> frequencyTable;
+            // Builds the tree and owns its nodes, root points into it
+            Compressor::HuffCompressor treeBuilder;
             HuffmanNode* root = nullptr;
+            // Reused between calls so a long lived decompressor doesn't allocate per file
+            vector<uint8_t> compressedData;
+
+            // root flattened for the decode kernel
+            vector<Kernels::DecodeNode> decodeNodes;
+            vector<Kernels::DecodeEntry> decodeTable;
     };
 }
\ No newline at end of file
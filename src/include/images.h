@@ -1,6 +1,10 @@
+#pragma once
+
 #include <opencv2/opencv.hpp>
 #include <iostream>
 #include <string>
+#include <vector>
+#include <cstdint>
 #include <filesystem>
 
 using std::string;
@@ -8,14 +12,55 @@ using std::vector;
 
 namespace Compressor {
 
+    // Settings shared by single image and batch image compression
+    struct ImageOptions {
+        int quality = 15;                       // 1-100, lower = higher compression (jpg and webp only, png etc. ignore it)
+        string format = "jpg";                  // output extension, also tells imencode which encoder to use
+        std::filesystem::path outputDir;        // empty = current working directory
+        unsigned int threads = 0;               // batch only - 0 = one per hardware thread
+
+        // Target size mode - search the quality (and optionally the dimensions) to fit a byte budget.
+        // quality above becomes the highest quality tried
+        size_t targetSize = 0;                  // 0 = disabled, use quality as is
+        int minQuality = 5;                     // never go below this quality
+        int maxTrials = 8;                      // upper bound on trial encodes per image
+        bool allowDownscale = false;            // shrink the image when even minQuality is too big
+    };
+
+    // Per-thread scratch space - kept across images so the buffers only grow to the largest image seen
+    struct ImageBuffers {
+        vector<uint8_t> read;                   // raw file bytes
+        vector<uchar> encoded;                  // best encoding so far, this is what gets written
+        vector<uchar> trial;                    // target size mode - candidate being measured
+    };
+
+    // What happened to one image
+    struct ImageResult {
+        size_t bytesIn = 0;
+        size_t bytesOut = 0;
+        int quality = 0;                        // quality of the written encoding
+        double scale = 1.0;                     // 1.0 unless the image was downscaled
+        int trials = 0;                         // number of encodes it took
+        bool targetMet = true;
+    };
+
     class ImageCompressor {
 
         public:
-            ImageCompressor() {}
-            
-            void compress(const std::filesystem::path& filePath);
+            explicit ImageCompressor(const ImageOptions& options = ImageOptions()) : options(options) {}
+
+            bool compress(const std::filesystem::path& filePath);
+            bool compressBatch(const vector<std::filesystem::path>& filePaths);
+
+            static vector<std::filesystem::path> collectImagePaths(const std::filesystem::path& input);
 
         private:
-            cv::Mat image;
+            bool checkOutputPaths(const vector<std::filesystem::path>& filePaths) const;
+            bool compressOne(const std::filesystem::path& filePath, ImageBuffers& buffers, ImageResult& result);
+            bool encodeToTarget(const cv::Mat& image, ImageBuffers& buffers, ImageResult& result);
+            vector<int> encodeParams(int quality) const;
+            std::filesystem::path outputPathFor(const std::filesystem::path& filePath) const;
+
+            ImageOptions options;
     };
-}
\ No newline at end of file
+}
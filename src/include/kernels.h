@@ -0,0 +1,59 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+using std::string;
+using std::vector;
+
+// Hot loops of the huffman coder, built once per instruction set and picked at runtime
+// so one fcmp binary runs everywhere but still uses the wide instructions where it can.
+namespace Kernels {
+
+    // Decoding looks up this many bits at once - codes up to this length decode in a single step
+    constexpr unsigned DECODE_TABLE_BITS = 11;
+    // The decoder reads 8 bytes at a time, so compressed input must be followed by this many readable bytes
+    constexpr size_t INPUT_PADDING = 8;
+    // Longest huffman code the bit packer accepts (int frequencies can't build a deeper tree anyway)
+    constexpr unsigned MAX_CODE_LENGTH = 56;
+
+    // One slot of the decode table, indexed by the next DECODE_TABLE_BITS bits of input
+    struct DecodeEntry {
+        uint16_t value;     // the symbol if isLeaf, otherwise the DecodeNode to continue walking from
+        uint8_t length;     // bits consumed by this entry
+        uint8_t isLeaf;
+    };
+
+    // Huffman tree flattened into an array, for codes longer than DECODE_TABLE_BITS
+    struct DecodeNode {
+        uint16_t child[2];  // index of the node for bit 0 / bit 1
+        uint8_t symbol;
+        uint8_t isLeaf;
+    };
+
+    struct KernelSet {
+        const char* name;
+
+        // Adds the number of times each byte value appears in data to counts[256]
+        void (*histogram)(const uint8_t* data, size_t size, uint64_t* counts);
+
+        // Writes the code of every input byte MSB first, zero padding the last byte.
+        // out must hold the total number of code bits rounded up to bytes. Returns bytes written.
+        size_t (*packBits)(const uint8_t* data, size_t size, const uint64_t* codes, const uint8_t* lengths, uint8_t* out);
+
+        // Decodes up to totalBits bits of in (followed by INPUT_PADDING bytes) into out. Returns symbols written.
+        size_t (*decode)(const uint8_t* in, uint64_t totalBits, const DecodeEntry* table, const DecodeNode* nodes,
+                         uint8_t* out, size_t outCapacity);
+    };
+
+    extern const KernelSet scalarKernels;
+#ifdef FCMP_X86_KERNELS
+    extern const KernelSet avx2Kernels;
+#endif
+
+    bool select(const string& name);
+    const KernelSet& active();
+    vector<string> supported();
+}
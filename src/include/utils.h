@@ -12,7 +12,8 @@ namespace Utils {
     string vector2String(vector<uint8_t> data);
     vector<uint8_t> string2Vector(string data);
     vector<uint8_t> readFile(const string &filePath);
-    bool writeFile(const string &filePath, vector<uint8_t> content);
+    bool tryReadFile(const string &filePath, vector<uint8_t> &buffer);
+    bool writeFile(const string &filePath, const vector<uint8_t> &content);
     
     
     // Append a value to the buffer as a series of bytes. Works for any type that can be converted to a byte array.
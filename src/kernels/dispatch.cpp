@@ -0,0 +1,56 @@
+#include "kernels.h"
+
+namespace Kernels {
+
+    namespace {
+        const KernelSet* selected = nullptr;
+
+        // Every kernel set this binary was built with, best first
+        vector<const KernelSet*> builtKernels() {
+#ifdef FCMP_X86_KERNELS
+            return {&avx2Kernels, &scalarKernels};
+#else
+            return {&scalarKernels};
+#endif
+        }
+
+        // Ask CPUID whether the kernel set can run here
+        bool cpuSupports(const KernelSet* kernels) {
+#ifdef FCMP_X86_KERNELS
+            __builtin_cpu_init();
+            if (kernels == &avx2Kernels) {
+                return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi") && __builtin_cpu_supports("bmi2");
+            }
+#endif
+            return kernels == &scalarKernels;
+        }
+    }
+
+    /// @brief Pick the kernels used for the rest of the run. Called once at startup.
+    /// @param name empty or "auto" for the best one this CPU supports, otherwise the name of the kernel set to force
+    /// @return false if the name is unknown or the CPU can't run it
+    bool select(const string& name) {
+        for (const KernelSet* kernels : builtKernels()) {
+            if (!cpuSupports(kernels)) continue;
+            if (name.empty() || name == "auto" || name == kernels->name) {
+                selected = kernels;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    const KernelSet& active() {
+        if (!selected) select("");
+        return *selected;
+    }
+
+    /// @brief Names of the kernel sets this CPU can run, best first
+    vector<string> supported() {
+        vector<string> names;
+        for (const KernelSet* kernels : builtKernels()) {
+            if (cpuSupports(kernels)) names.push_back(kernels->name);
+        }
+        return names;
+    }
+}
@@ -0,0 +1,6 @@
+// Built with -mavx2 -mbmi -mbmi2 - selected only when CPUID reports AVX2, BMI1 and BMI2
+#include "kernels_impl.h"
+
+namespace Kernels {
+    const KernelSet avx2Kernels = {"avx2", histogramSplit, packBitsWords, decodeTable};
+}
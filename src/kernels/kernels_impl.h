@@ -0,0 +1,216 @@
+// Shared body of the kernel variants.
+// Every variant runs the same algorithms - only the instructions differ, so --cpu compares instruction sets.
+// Each kernels_<variant>.cpp includes this once and is compiled with that variant's instruction set flags
+// (see CMakeLists.txt). With BMI2 the variable shifts that carry the bit position in packBitsWords and
+// decodeTable become single uop shlx/shrx, and the #if blocks below pick the AVX2 / BMI1 intrinsics.
+// Everything lives in an unnamed namespace: the copies built with wide instructions must never be merged by the
+// linker into the scalar build, which is what would happen to ordinary inline functions.
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#if defined(__AVX2__) || defined(__BMI__)
+#include <immintrin.h>
+#endif
+
+#include "kernels.h"
+
+namespace {
+    using namespace Kernels;
+
+    inline uint64_t loadBigEndian64(const uint8_t* p) {
+        uint64_t word;
+        std::memcpy(&word, p, sizeof(word));
+#if defined(__GNUC__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        return __builtin_bswap64(word);
+#elif defined(__GNUC__)
+        return word;
+#else
+        word = 0;
+        for (int i = 0; i < 8; i++) word = (word << 8) | p[i];
+        return word;
+#endif
+    }
+
+    inline void storeBigEndian32(uint8_t* p, uint32_t word) {
+#if defined(__GNUC__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        word = __builtin_bswap32(word);
+        std::memcpy(p, &word, sizeof(word));
+#else
+        p[0] = uint8_t(word >> 24);
+        p[1] = uint8_t(word >> 16);
+        p[2] = uint8_t(word >> 8);
+        p[3] = uint8_t(word);
+#endif
+    }
+
+    /// @brief Add the four sub-tables into the 64 bit counts
+    inline void mergeTables(const uint32_t (&tables)[4][256], uint64_t* counts) {
+#if defined(__AVX2__)
+        for (int s = 0; s < 256; s += 8) {
+            __m256i sum = _mm256_add_epi32(
+                _mm256_add_epi32(_mm256_load_si256(reinterpret_cast<const __m256i*>(&tables[0][s])),
+                                 _mm256_load_si256(reinterpret_cast<const __m256i*>(&tables[1][s]))),
+                _mm256_add_epi32(_mm256_load_si256(reinterpret_cast<const __m256i*>(&tables[2][s])),
+                                 _mm256_load_si256(reinterpret_cast<const __m256i*>(&tables[3][s]))));
+            __m256i low = _mm256_cvtepu32_epi64(_mm256_castsi256_si128(sum));
+            __m256i high = _mm256_cvtepu32_epi64(_mm256_extracti128_si256(sum, 1));
+            __m256i* out = reinterpret_cast<__m256i*>(counts + s);
+            _mm256_storeu_si256(out, _mm256_add_epi64(_mm256_loadu_si256(out), low));
+            _mm256_storeu_si256(out + 1, _mm256_add_epi64(_mm256_loadu_si256(out + 1), high));
+        }
+#else
+        for (int s = 0; s < 256; s++) {
+            counts[s] += uint64_t(tables[0][s]) + tables[1][s] + tables[2][s] + tables[3][s];
+        }
+#endif
+    }
+
+    /// @brief Four sub-tables, 8 bytes per load, so neighbouring equal bytes hit different counters
+    inline void histogramSplit(const uint8_t* data, size_t size, uint64_t* counts) {
+        alignas(32) uint32_t tables[4][256];
+        // Small enough blocks that no 32 bit sub-table counter can overflow
+        const size_t blockSize = size_t(1) << 30;
+
+        while (size > 0) {
+            size_t block = size < blockSize ? size : blockSize;
+            std::memset(tables, 0, sizeof(tables));
+
+            size_t i = 0;
+            for (; i + 8 <= block; i += 8) {
+                uint64_t word;
+                std::memcpy(&word, data + i, sizeof(word));
+                tables[0][word & 0xFF]++;
+                tables[1][(word >> 8) & 0xFF]++;
+                tables[2][(word >> 16) & 0xFF]++;
+                tables[3][(word >> 24) & 0xFF]++;
+                tables[0][(word >> 32) & 0xFF]++;
+                tables[1][(word >> 40) & 0xFF]++;
+                tables[2][(word >> 48) & 0xFF]++;
+                tables[3][word >> 56]++;
+            }
+            for (; i < block; i++) {
+                tables[0][data[i]]++;
+            }
+            mergeTables(tables, counts);
+
+            data += block;
+            size -= block;
+        }
+    }
+
+    /// @brief Bit packing that writes out 32 bits at a time with one byte swapped store
+    inline size_t packBitsWords(const uint8_t* data, size_t size, const uint64_t* codes, const uint8_t* lengths, uint8_t* out) {
+        uint8_t* p = out;
+        uint64_t bits = 0;      // only the low `count` bits are pending
+        unsigned count = 0;     // always < 32 between symbols
+
+        for (size_t i = 0; i < size; i++) {
+            uint64_t code = codes[data[i]];
+            unsigned length = lengths[data[i]];
+
+            // Rare very long code - push the part above 32 bits first so `bits` can't overflow
+            if (length > 32) {
+                unsigned highLength = length - 32;
+                bits = (bits << highLength) | (code >> 32);
+                count += highLength;
+                if (count >= 32) {
+                    count -= 32;
+                    storeBigEndian32(p, uint32_t(bits >> count));
+                    p += 4;
+                }
+                code &= 0xFFFFFFFF;
+                length = 32;
+            }
+
+            bits = (bits << length) | code;
+            count += length;
+            if (count >= 32) {
+                count -= 32;
+                storeBigEndian32(p, uint32_t(bits >> count));
+                p += 4;
+            }
+        }
+
+        while (count >= 8) {
+            count -= 8;
+            *p++ = uint8_t(bits >> count);
+        }
+        if (count > 0) {
+            *p++ = uint8_t(bits << (8 - count));
+        }
+        return p - out;
+    }
+
+    /// @brief Next DECODE_TABLE_BITS bits starting at bit position pos, MSB first
+    inline uint32_t peekBits(const uint8_t* in, uint64_t pos) {
+        uint64_t word = loadBigEndian64(in + (pos >> 3));
+        unsigned offset = unsigned(pos & 7);
+#if defined(__BMI__) && defined(__x86_64__)
+        return uint32_t(_bextr_u64(word, 64 - offset - DECODE_TABLE_BITS, DECODE_TABLE_BITS));
+#else
+        return uint32_t((word << offset) >> (64 - DECODE_TABLE_BITS));
+#endif
+    }
+
+    /// @brief Table driven decode - one lookup per symbol for codes up to DECODE_TABLE_BITS long,
+    /// longer codes continue down the flattened tree from where the table left off
+    inline size_t decodeTable(const uint8_t* in, uint64_t totalBits, const DecodeEntry* table, const DecodeNode* nodes,
+                       uint8_t* out, size_t outCapacity) {
+        size_t written = 0;
+        uint64_t pos = 0;
+
+        // Bulk loop: one 8 byte load gives at least 57 bits, enough for SYMBOLS_PER_LOAD short codes.
+        // Between loads the only dependency is shifting the bit buffer by each code length (a single shlx with BMI2).
+        constexpr unsigned SYMBOLS_PER_LOAD = 57 / DECODE_TABLE_BITS;
+        while (pos + 57 <= totalBits && written + SYMBOLS_PER_LOAD <= outCapacity) {
+            uint64_t bits = loadBigEndian64(in + (pos >> 3)) << (pos & 7);
+            unsigned used = 0;
+            for (unsigned k = 0; k < SYMBOLS_PER_LOAD; k++) {
+                // Copy the entry - out is a byte pointer, so stores through it could alias the table
+                const DecodeEntry entry = table[bits >> (64 - DECODE_TABLE_BITS)];
+                if (!entry.isLeaf) {
+                    // Long code - walk the rest of the tree, then reload at the new position
+                    pos += used + entry.length;
+                    used = 0;
+                    uint16_t node = entry.value;
+                    while (!nodes[node].isLeaf) {
+                        if (pos >= totalBits) return written;
+                        unsigned bit = (in[pos >> 3] >> (7 - (pos & 7))) & 1;
+                        node = nodes[node].child[bit];
+                        pos++;
+                    }
+                    out[written++] = nodes[node].symbol;
+                    break;
+                }
+                out[written++] = uint8_t(entry.value);
+                bits <<= entry.length;
+                used += entry.length;
+            }
+            pos += used;
+        }
+
+        while (pos < totalBits && written < outCapacity) {
+            const DecodeEntry entry = table[peekBits(in, pos)];
+            // Only padding or a cut off code left
+            if (pos + entry.length > totalBits) break;
+            pos += entry.length;
+
+            if (entry.isLeaf) {
+                out[written++] = uint8_t(entry.value);
+                continue;
+            }
+
+            uint16_t node = entry.value;
+            while (!nodes[node].isLeaf) {
+                if (pos >= totalBits) return written;
+                unsigned bit = (in[pos >> 3] >> (7 - (pos & 7))) & 1;
+                node = nodes[node].child[bit];
+                pos++;
+            }
+            out[written++] = nodes[node].symbol;
+        }
+        return written;
+    }
+}
@@ -0,0 +1,6 @@
+// Built without any extra instruction set flags - runs on every CPU
+#include "kernels_impl.h"
+
+namespace Kernels {
+    const KernelSet scalarKernels = {"scalar", histogramSplit, packBitsWords, decodeTable};
+}
@@ -6,11 +6,18 @@
 #include <stdlib.h>
 #include "stdint.h"
 #include <filesystem>
+#include <chrono>
+#include <cmath>
+#include <limits>
 
 #include "utils.h"
 #include "compressor.h"
 #include "decompressor.h"
 #include "images.h"
+#include "kernels.h"
+#ifdef FCMP_DAEMON
+#include "daemon.h"
+#endif
 
 using std::string;
 using std::vector;
@@ -22,7 +29,10 @@ void print_usage_and_exit() {
               << "Usage: \n\n"
               << "  Compressing   -  fcmp compress <input_file_path>\n"
               << "  Decompressing -  fcmp decompress <input_file_path>\n"
-              << "  Images        -  fcmp image <input_file_path>\n"
+              << "  Images        -  fcmp image <input_file_path> [image options]\n"
+              << "  Image batch   -  fcmp image-batch <directory_or_list_file> [image options]\n"
+              << "  Daemon        -  fcmp serve --socket <socket_path> [--workers <n>] [--max-queue <n>] [--max-size <size>]\n"
+              << "  Daemon client -  fcmp client --socket <socket_path> <compress|decompress> <input_file_path> [--inline]\n"
               << "  \n"
               << "  For non-images:\n"
               << "      The output file will have the same name as the input file but with a.fcm extension.\n"
@@ -31,7 +41,33 @@ void print_usage_and_exit() {
               << "      The decompressed file will have the same name as the input file but with the original extension.\n"
               << "\n"
               << "  For Images:\n"
-              << "      The output image will be saved as <original_file_name> + _compressed.jpg\n"
+              << "      The output image will be saved as <original_file_name> + _compressed.<format>\n"
+              << "      image-batch takes a directory of images or a text file with one image path per line\n"
+              << "      and compresses them in parallel, reporting images per second.\n"
+              << "\n"
+              << "  Image options:\n"
+              << "      --quality <1-100>     jpg/webp quality, lower = higher compression (default 15)\n"
+              << "      --format <ext>        output format: jpg, png, webp, ... (default jpg)\n"
+              << "      --output-dir <dir>    where to write compressed images (default current directory)\n"
+              << "      --threads <n>         image-batch worker threads (default one per CPU core)\n"
+              << "      --target-size <size>  search the quality to fit each image in <size> bytes, eg 200K or 1.5M\n"
+              << "                            (jpg/webp only, --quality becomes the highest quality tried, default 95)\n"
+              << "      --min-quality <1-100> lowest quality the target size search may use (default 5)\n"
+              << "      --max-trials <n>      most trial encodes per image in the target size search (default 8)\n"
+              << "      --downscale           let the target size search shrink images that don't fit at --min-quality\n"
+              << "\n"
+              << "  Daemon:\n"
+              << "      fcmp serve keeps compressors and buffers warm and listens on a unix domain socket.\n"
+              << "      --workers is how many jobs run at once (default one per CPU core), --max-queue how many\n"
+              << "      connections may wait for a worker before new ones are turned away (default 64), --max-size\n"
+              << "      the biggest file or inline payload the server will take, eg 512M (default 256M).\n"
+              << "      fcmp client sends it one request. By default the server reads and writes the files itself\n"
+              << "      (decompressed files go next to the .fcm file); with --inline the client sends the data and\n"
+              << "      writes the result like the compress / decompress commands do.\n"
+              << "\n"
+              << "  Global options:\n"
+              << "      --cpu <variant>       force the compression kernels: auto, scalar or avx2 (default auto,\n"
+              << "                            the best this CPU supports). For benchmarking and comparing outputs.\n"
               << "Examples: \n"
               << "  fcmp compress \"C:\\directory\\file.txt\" \n"
               << "      creates file_compressed.fcm in C:\\directory \n\n"
@@ -39,15 +75,245 @@ void print_usage_and_exit() {
               << "      creates original file in C:\\directory \n\n"
               << "  fcmp image \"C:\\directory\\file.jpg\" \n"
               << "      creates file_compressed.jpg in C:\\directory \n\n"
+              << "  fcmp image-batch \"C:\\photos\" --quality 40 --output-dir \"C:\\thumbs\" \n"
+              << "      creates <name>_compressed.jpg in C:\\thumbs for every image in C:\\photos \n\n"
+              << "  fcmp image \"C:\\directory\\file.jpg\" --target-size 200K --min-quality 30 \n"
+              << "      creates file_compressed.jpg of at most 200 KiB, at the best quality that fits \n\n"
+              << "  fcmp serve --socket /tmp/fcmp.sock --workers 4 \n"
+              << "  fcmp client --socket /tmp/fcmp.sock compress /data/file.txt \n"
+              << "      creates file_compressed.fcm in /data through the running server \n\n"
 
               << std::endl;
     exit(1);
 }
 
 
+/// @brief Parse a byte count with an optional K/M/G suffix (powers of 1024), eg 200K
+size_t parse_size(const string& value) {
+    size_t suffixPos = 0;
+    double number = std::stod(value, &suffixPos);
+    string suffix = value.substr(suffixPos);
+
+    double multiplier = 1;
+    if (suffix == "K" || suffix == "k" || suffix == "KB" || suffix == "kb") multiplier = 1024.0;
+    else if (suffix == "M" || suffix == "m" || suffix == "MB" || suffix == "mb") multiplier = 1024.0 * 1024.0;
+    else if (suffix == "G" || suffix == "g" || suffix == "GB" || suffix == "gb") multiplier = 1024.0 * 1024.0 * 1024.0;
+    else if (!suffix.empty() && suffix != "B" && suffix != "b") throw std::invalid_argument("unknown size suffix");
+
+    // 0.5 would round down to 0 and quietly mean "no size", and nan / inf / 1e30 don't fit in a size_t
+    double bytes = number * multiplier;
+    if (!std::isfinite(bytes) || bytes < 1) throw std::invalid_argument("size must be at least 1 byte");
+    if (bytes >= static_cast<double>(std::numeric_limits<size_t>::max())) throw std::out_of_range("size too large");
+    return static_cast<size_t>(bytes);
+}
+
+#ifdef USE_OPENCV
+/// @brief Parse the optional image flags that follow the input path
+ImageOptions parse_image_options(int argc, char *argv[]) {
+    ImageOptions options;
+    bool qualitySet = false;
+    for (int i = 3; i < argc; i++) {
+        string flag = argv[i];
+        if (flag == "--downscale") {
+            options.allowDownscale = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            print_usage_and_exit();
+        }
+        string value = argv[++i];
+
+        try {
+            if (flag == "--quality") {
+                options.quality = std::stoi(value);
+                if (options.quality < 1 || options.quality > 100) print_usage_and_exit();
+                qualitySet = true;
+            } else if (flag == "--format") {
+                // allow both "jpg" and ".jpg"
+                options.format = (!value.empty() && value[0] == '.') ? value.substr(1) : value;
+            } else if (flag == "--output-dir") {
+                options.outputDir = value;
+            } else if (flag == "--threads") {
+                options.threads = static_cast<unsigned int>(std::stoul(value));
+            } else if (flag == "--target-size") {
+                options.targetSize = parse_size(value);
+            } else if (flag == "--min-quality") {
+                options.minQuality = std::stoi(value);
+                if (options.minQuality < 1 || options.minQuality > 100) print_usage_and_exit();
+            } else if (flag == "--max-trials") {
+                options.maxTrials = std::stoi(value);
+                if (options.maxTrials < 1) print_usage_and_exit();
+            } else {
+                print_usage_and_exit();
+            }
+        } catch (const std::exception&) {
+            print_usage_and_exit();
+        }
+    }
+
+    // imencode throws on an extension it has no encoder for (e.g. gif, or webp without webp support)
+    if (options.format.empty() || !cv::haveImageWriter("x." + options.format)) {
+        std::cerr << "No image encoder for format: " << options.format << std::endl;
+        print_usage_and_exit();
+    }
+
+    if (options.targetSize > 0) {
+        if (options.format != "jpg" && options.format != "jpeg" && options.format != "webp") {
+            std::cerr << "--target-size needs a format with a quality setting (jpg or webp)." << std::endl;
+            exit(1);
+        }
+        if (!qualitySet) options.quality = 95;
+        if (options.minQuality > options.quality) {
+            std::cerr << "--min-quality can't be higher than --quality." << std::endl;
+            exit(1);
+        }
+    }
+
+    if (!options.outputDir.empty()) {
+        std::error_code ec;
+        std::filesystem::create_directories(options.outputDir, ec);
+        if (ec || !std::filesystem::is_directory(options.outputDir, ec)) {
+            std::cerr << "Could not create output directory " << options.outputDir.string()
+                      << (ec ? ": " + ec.message() : string()) << std::endl;
+            exit(1);
+        }
+    }
+    return options;
+}
+#endif
+
+#ifdef FCMP_DAEMON
+/// @brief fcmp serve --socket <path> [--workers <n>] [--max-queue <n>]
+int run_serve(int argc, char *argv[]) {
+    Daemon::ServerOptions options;
+    for (int i = 2; i + 1 < argc; i += 2) {
+        string flag = argv[i];
+        string value = argv[i + 1];
+        try {
+            if (flag == "--socket") {
+                options.socketPath = value;
+            } else if (flag == "--workers") {
+                options.workers = static_cast<unsigned int>(std::stoul(value));
+            } else if (flag == "--max-queue") {
+                options.maxQueue = std::stoul(value);
+            } else if (flag == "--max-size") {
+                options.maxPayloadSize = parse_size(value);
+            } else {
+                print_usage_and_exit();
+            }
+        } catch (const std::exception&) {
+            print_usage_and_exit();
+        }
+    }
+    if (argc % 2 != 0 || options.socketPath.empty() || options.maxQueue == 0) {
+        print_usage_and_exit();
+    }
+
+    std::cout << "Starting server (" << Kernels::active().name << " kernels)..... " << std::endl;
+    Daemon::FcmpServer server(options);
+    return server.run();
+}
+
+/// @brief fcmp client --socket <path> <compress|decompress> <input_file_path> [--inline]
+int run_client(int argc, char *argv[]) {
+    string socketPath;
+    vector<string> positional;
+    bool sendInline = false;
+    for (int i = 2; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--socket" && i + 1 < argc) {
+            socketPath = argv[++i];
+        } else if (arg == "--inline") {
+            sendInline = true;
+        } else {
+            positional.push_back(arg);
+        }
+    }
+    if (socketPath.empty() || positional.size() != 2 ||
+        (positional[0] != "compress" && positional[0] != "decompress")) {
+        print_usage_and_exit();
+    }
+    bool compress = positional[0] == "compress";
+    std::filesystem::path filePath(positional[1]);
+
+    Daemon::Message request;
+    Daemon::Message reply;
+    if (sendInline) {
+        request.code = static_cast<uint8_t>(compress ? Daemon::Op::Compress : Daemon::Op::Decompress);
+        request.name = filePath.filename().string();
+        request.payload = Utils::readFile(filePath.string());
+    } else {
+        // The server has its own working directory, so send it a full path
+        request.code = static_cast<uint8_t>(compress ? Daemon::Op::CompressFile : Daemon::Op::DecompressFile);
+        request.name = std::filesystem::absolute(filePath).string();
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    Daemon::FcmpClient client(socketPath);
+    if (!client.send(request, reply)) {
+        std::cerr << "Error: Could not reach the server on " << socketPath << std::endl;
+        return 1;
+    }
+    double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    if (reply.code != static_cast<uint8_t>(Daemon::Status::Ok)) {
+        std::cerr << Utils::vector2String(reply.payload) << std::endl;
+        return 1;
+    }
+
+    string outputPath = reply.name;
+    if (sendInline) {
+        // Same places the compress / decompress commands write to. Never trust a path from the other side
+        outputPath = compress ? HuffCompressor::compressedPathFor(filePath).string()
+                              : std::filesystem::path(reply.name).filename().string();
+        if (outputPath.empty() || !Utils::writeFile(outputPath, reply.payload)) {
+            std::cerr << "Error writing output file." << std::endl;
+            return 1;
+        }
+    }
+
+    std::cout << (compress ? "Compressed" : "Decompressed") << " file written to: " << outputPath
+              << " (" << milliseconds << " ms)" << std::endl;
+    return 0;
+}
+#endif
+
 int main(int argc, char *argv[]) {
+
+    // Pull out the global --cpu option so the commands below only see their own arguments
+    string cpuVariant;
+    vector<char*> args;
+    for (int i = 0; i < argc; i++) {
+        if (string(argv[i]) == "--cpu" && i + 1 < argc) {
+            cpuVariant = argv[++i];
+            continue;
+        }
+        args.push_back(argv[i]);
+    }
+    argc = static_cast<int>(args.size());
+    argv = args.data();
+
+    // Pick the kernels once, before any work starts
+    if (!Kernels::select(cpuVariant)) {
+        std::cerr << "Kernel variant " << cpuVariant << " is not available on this CPU. Supported:";
+        for (const string& name : Kernels::supported()) {
+            std::cerr << " " << name;
+        }
+        std::cerr << std::endl;
+        exit(1);
+    }
+
+    // The daemon commands take flags instead of a single input file
+    if (argc > 1 && (string(argv[1]) == "serve" || string(argv[1]) == "client")) {
+        #ifdef FCMP_DAEMON
+            return string(argv[1]) == "serve" ? run_serve(argc, argv) : run_client(argc, argv);
+        #else
+            std::cerr << "The fcmp daemon needs unix domain sockets, which this build does not support." << std::endl;
+            exit(1);
+        #endif
+    }
     
-    if (argc != 3) {
+    if (argc < 3) {
         print_usage_and_exit();
     }
 
@@ -58,25 +324,36 @@ int main(int argc, char *argv[]) {
     std::cout << "Input file path " << input_file_path << std::endl;
     
     string command = argv[1];
+    bool isImageCommand = (command == "image" || command == "image-batch");
+    if (argc != 3 && !isImageCommand) {
+        print_usage_and_exit();
+    }
+
     if (command == "compress") {
         // Run compression program
         HuffCompressor compressor;
-        std::cout << "Compressing..... " << std::endl;
+        std::cout << "Compressing (" << Kernels::active().name << " kernels)..... " << std::endl;
         vector<uint8_t> file_data = Utils::readFile(input_file_path);
         compressor.compress(input_file_path, file_data);
 
     } else if (command == "decompress") {
         
-        std::cout << "Decompressing..... " << std::endl;
+        std::cout << "Decompressing (" << Kernels::active().name << " kernels)..... " << std::endl;
         HuffDecompressor decompressor;
         decompressor.decompress(input_file_path);
 
-    } else if (command == "image") {
+    } else if (isImageCommand) {
         // Check if opencv is available
         #ifdef USE_OPENCV
-            ImageCompressor imageCompressor;
-            std::cout << "Compressing Image..... " << std::endl;
-            imageCompressor.compress(filePath);
+            ImageCompressor imageCompressor(parse_image_options(argc, argv));
+            if (command == "image") {
+                std::cout << "Compressing Image..... " << std::endl;
+                if (!imageCompressor.compress(filePath)) return 1;
+            } else {
+                vector<std::filesystem::path> imagePaths = ImageCompressor::collectImagePaths(filePath);
+                std::cout << "Compressing " << imagePaths.size() << " Images..... " << std::endl;
+                if (!imageCompressor.compressBatch(imagePaths)) return 1;
+            }
         #else
             std::cerr << "OpenCV is not available. Please install OpenCV to use the image compression feature." << std::endl;
             exit(1);
@@ -61,7 +61,24 @@ namespace Utils {
         return buffer;
     }
 
-    bool writeFile(const string &filePath, vector<uint8_t> content) {
+    /// @brief Like readFile but reports failure instead of exiting, for long running callers (the daemon)
+    /// @param buffer receives the file contents, its capacity is reused
+    bool tryReadFile(const string &filePath, vector<uint8_t> &buffer) {
+        std::ifstream file(filePath.c_str(), std::ios::binary | std::ios::ate);
+        if (!file) {
+            return false;
+        }
+
+        std::streamoff fileSize = file.tellg();
+        if (fileSize < 0) {
+            return false;
+        }
+        buffer.resize(static_cast<size_t>(fileSize));
+        file.seekg(0, std::ios::beg);
+        return static_cast<bool>(file.read(reinterpret_cast<char *>(buffer.data()), fileSize));
+    }
+
+    bool writeFile(const string &filePath, const vector<uint8_t> &content) {
         std::ofstream file(filePath, std::ios::binary);
         if (!file) {
             std::cerr << "Error opening file: " << filePath << std::endl;
@@ -0,0 +1,138 @@
+# Starts fcmp serve, runs path based and inline compress / decompress round trips of INPUT through fcmp client,
+# checks that a truncated .fcm file gets an error reply (and the server keeps serving), then stops the server.
+# Run by ctest on unix, see CMakeLists.txt.
+#
+#   cmake -DFCMP=<fcmp executable> -DINPUT=<file> -DWORK_DIR=<scratch directory> -P check_daemon.cmake
+
+get_filename_component(INPUT_NAME ${INPUT} NAME)
+get_filename_component(INPUT_STEM ${INPUT} NAME_WE)
+set(COMPRESSED_NAME ${INPUT_STEM}_compressed.fcm)
+
+file(REMOVE_RECURSE ${WORK_DIR})
+file(MAKE_DIRECTORY ${WORK_DIR}/reference ${WORK_DIR}/path ${WORK_DIR}/inline/restored ${WORK_DIR}/truncated)
+
+# unix socket paths are limited to ~100 characters, build directories can be deeper than that
+set(SOCKET ${WORK_DIR}/fcmp.sock)
+string(LENGTH ${SOCKET} SOCKET_LENGTH)
+if(SOCKET_LENGTH GREATER 100)
+    string(RANDOM LENGTH 8 SUFFIX)
+    set(SOCKET /tmp/fcmp_check_${SUFFIX}.sock)
+endif()
+
+set(SERVER_PID "")
+macro(fail MESSAGE)
+    if(NOT SERVER_PID STREQUAL "")
+        execute_process(COMMAND kill ${SERVER_PID})
+    endif()
+    message(FATAL_ERROR "${MESSAGE}")
+endmacro()
+
+# Runs fcmp client in DIR with the given arguments, leaves its exit code in CLIENT_RESULT and output in CLIENT_OUTPUT
+macro(run_client DIR)
+    execute_process(
+        COMMAND ${FCMP} client --socket ${SOCKET} ${ARGN}
+        WORKING_DIRECTORY ${DIR}
+        RESULT_VARIABLE CLIENT_RESULT
+        OUTPUT_VARIABLE CLIENT_OUTPUT
+        ERROR_VARIABLE CLIENT_OUTPUT
+    )
+endmacro()
+
+macro(expect_same_file EXPECTED ACTUAL)
+    execute_process(COMMAND ${CMAKE_COMMAND} -E compare_files ${EXPECTED} ${ACTUAL} RESULT_VARIABLE DIFFERENT)
+    if(DIFFERENT)
+        fail("${ACTUAL} does not match ${EXPECTED}")
+    endif()
+endmacro()
+
+# What the server should produce - the plain compress command
+configure_file(${INPUT} ${WORK_DIR}/reference/${INPUT_NAME} COPYONLY)
+execute_process(COMMAND ${FCMP} compress ${INPUT_NAME} WORKING_DIRECTORY ${WORK_DIR}/reference
+                RESULT_VARIABLE RESULT OUTPUT_QUIET ERROR_QUIET)
+if(NOT RESULT EQUAL 0)
+    fail("compress failed")
+endif()
+set(REFERENCE ${WORK_DIR}/reference/${COMPRESSED_NAME})
+
+# Start the server in the background and wait for its socket
+execute_process(
+    COMMAND sh -c "\"$0\" serve --socket \"$1\" --workers 2 > \"$2\" 2>&1 & echo $!"
+            ${FCMP} ${SOCKET} ${WORK_DIR}/serve.log
+    OUTPUT_VARIABLE SERVER_PID
+    OUTPUT_STRIP_TRAILING_WHITESPACE
+)
+foreach(ATTEMPT RANGE 50)
+    if(EXISTS ${SOCKET})
+        break()
+    endif()
+    execute_process(COMMAND ${CMAKE_COMMAND} -E sleep 0.1)
+endforeach()
+if(NOT EXISTS ${SOCKET})
+    file(READ ${WORK_DIR}/serve.log SERVE_LOG)
+    fail("fcmp serve did not start\n${SERVE_LOG}")
+endif()
+
+# The server reads and writes the files itself
+configure_file(${INPUT} ${WORK_DIR}/path/${INPUT_NAME} COPYONLY)
+run_client(${WORK_DIR} compress ${WORK_DIR}/path/${INPUT_NAME})
+if(NOT CLIENT_RESULT EQUAL 0)
+    fail("path compress failed\n${CLIENT_OUTPUT}")
+endif()
+expect_same_file(${REFERENCE} ${WORK_DIR}/path/${COMPRESSED_NAME})
+file(REMOVE ${WORK_DIR}/path/${INPUT_NAME})
+run_client(${WORK_DIR} decompress ${WORK_DIR}/path/${COMPRESSED_NAME})
+if(NOT CLIENT_RESULT EQUAL 0)
+    fail("path decompress failed\n${CLIENT_OUTPUT}")
+endif()
+expect_same_file(${INPUT} ${WORK_DIR}/path/${INPUT_NAME})
+
+# The data travels over the socket, the client writes the results
+configure_file(${INPUT} ${WORK_DIR}/inline/${INPUT_NAME} COPYONLY)
+run_client(${WORK_DIR}/inline compress ${INPUT_NAME} --inline)
+if(NOT CLIENT_RESULT EQUAL 0)
+    fail("inline compress failed\n${CLIENT_OUTPUT}")
+endif()
+expect_same_file(${REFERENCE} ${WORK_DIR}/inline/${COMPRESSED_NAME})
+run_client(${WORK_DIR}/inline/restored decompress ../${COMPRESSED_NAME} --inline)
+if(NOT CLIENT_RESULT EQUAL 0)
+    fail("inline decompress failed\n${CLIENT_OUTPUT}")
+endif()
+expect_same_file(${INPUT} ${WORK_DIR}/inline/restored/${INPUT_NAME})
+
+# A .fcm file cut short must be refused, both ways, without taking the server down
+file(SIZE ${REFERENCE} COMPRESSED_SIZE)
+math(EXPR TRUNCATED_SIZE "${COMPRESSED_SIZE} - 16")
+set(TRUNCATED ${WORK_DIR}/truncated/${COMPRESSED_NAME})
+execute_process(COMMAND head -c ${TRUNCATED_SIZE} ${REFERENCE} OUTPUT_FILE ${TRUNCATED})
+foreach(MODE path inline)
+    if(MODE STREQUAL "inline")
+        run_client(${WORK_DIR}/truncated decompress ${TRUNCATED} --inline)
+    else()
+        run_client(${WORK_DIR}/truncated decompress ${TRUNCATED})
+    endif()
+    if(CLIENT_RESULT EQUAL 0 OR NOT CLIENT_OUTPUT MATCHES "truncated or corrupt")
+        fail("${MODE} decompress of a truncated file was not refused\n${CLIENT_OUTPUT}")
+    endif()
+endforeach()
+if(EXISTS ${WORK_DIR}/truncated/${INPUT_NAME})
+    fail("decompressing a truncated file wrote output")
+endif()
+
+run_client(${WORK_DIR}/inline compress ${INPUT_NAME} --inline)
+if(NOT CLIENT_RESULT EQUAL 0)
+    fail("server stopped answering after the truncated file\n${CLIENT_OUTPUT}")
+endif()
+
+# SIGTERM - the server finishes queued work and removes its socket
+execute_process(COMMAND kill ${SERVER_PID})
+foreach(ATTEMPT RANGE 50)
+    if(NOT EXISTS ${SOCKET})
+        break()
+    endif()
+    execute_process(COMMAND ${CMAKE_COMMAND} -E sleep 0.1)
+endforeach()
+if(EXISTS ${SOCKET})
+    set(SERVER_PID "")
+    message(FATAL_ERROR "fcmp serve did not shut down cleanly")
+endif()
+message(STATUS "daemon: ok")
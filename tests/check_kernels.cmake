@@ -0,0 +1,59 @@
+# Compresses INPUT with every kernel variant (fcmp --cpu) this CPU can run, checks that all of them write
+# byte-identical .fcm files and that each one decompresses back to INPUT. Run by ctest, see CMakeLists.txt.
+#
+#   cmake -DFCMP=<fcmp executable> -DINPUT=<file> -DWORK_DIR=<scratch directory> -P check_kernels.cmake
+
+get_filename_component(INPUT_NAME ${INPUT} NAME)
+get_filename_component(INPUT_STEM ${INPUT} NAME_WE)
+file(REMOVE_RECURSE ${WORK_DIR})
+
+set(REFERENCE_VARIANT "")
+foreach(VARIANT scalar avx2)
+    set(DIR ${WORK_DIR}/${VARIANT})
+    file(MAKE_DIRECTORY ${DIR}/restored)
+    configure_file(${INPUT} ${DIR}/${INPUT_NAME} COPYONLY)
+
+    execute_process(
+        COMMAND ${FCMP} compress ${INPUT_NAME} --cpu ${VARIANT}
+        WORKING_DIRECTORY ${DIR}
+        RESULT_VARIABLE RESULT
+        OUTPUT_VARIABLE OUTPUT
+        ERROR_VARIABLE OUTPUT
+    )
+    if(NOT RESULT EQUAL 0)
+        if(OUTPUT MATCHES "not available on this CPU")
+            message(STATUS "${VARIANT}: not supported on this CPU, skipped")
+            continue()
+        endif()
+        message(FATAL_ERROR "${VARIANT}: compress failed\n${OUTPUT}")
+    endif()
+
+    set(COMPRESSED ${DIR}/${INPUT_STEM}_compressed.fcm)
+    if(REFERENCE_VARIANT STREQUAL "")
+        set(REFERENCE_VARIANT ${VARIANT})
+        set(REFERENCE ${COMPRESSED})
+    else()
+        execute_process(COMMAND ${CMAKE_COMMAND} -E compare_files ${REFERENCE} ${COMPRESSED} RESULT_VARIABLE DIFFERENT)
+        if(DIFFERENT)
+            message(FATAL_ERROR "${VARIANT} and ${REFERENCE_VARIANT} wrote different compressed files")
+        endif()
+    endif()
+
+    # decompress writes the original file name into the working directory
+    execute_process(
+        COMMAND ${FCMP} decompress ${COMPRESSED} --cpu ${VARIANT}
+        WORKING_DIRECTORY ${DIR}/restored
+        RESULT_VARIABLE RESULT
+        OUTPUT_VARIABLE OUTPUT
+        ERROR_VARIABLE OUTPUT
+    )
+    execute_process(COMMAND ${CMAKE_COMMAND} -E compare_files ${INPUT} ${DIR}/restored/${INPUT_NAME} RESULT_VARIABLE DIFFERENT)
+    if(NOT RESULT EQUAL 0 OR DIFFERENT)
+        message(FATAL_ERROR "${VARIANT}: decompressed file does not match ${INPUT}\n${OUTPUT}")
+    endif()
+    message(STATUS "${VARIANT}: ok")
+endforeach()
+
+if(REFERENCE_VARIANT STREQUAL "")
+    message(FATAL_ERROR "No kernel variant could run")
+endif()